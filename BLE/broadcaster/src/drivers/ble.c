@@ -10,6 +10,9 @@
 #include "ble.h"
 #include <zephyr/bluetooth/hci.h>
 #include <zephyr/bluetooth/conn.h>
+#if defined(CONFIG_SENSORS_EMULATED) && defined(CONFIG_BOARD_NRF52_BSIM)
+#include "argparse.h" /* get_device_nbr() */
+#endif
 
 LOG_MODULE_REGISTER(BLE_DRIVER, CONFIG_BLE_DRIVER_LOG_LEVEL);
 
@@ -17,12 +20,14 @@ static int counter;
 
 static bool isInisialized = false;
 
-static uint8_t service_data[22] = {0};
+static struct payload service_data;
+
+static int64_t sample_ms;
 
 static bt_addr_le_t addr;
 
 static const struct bt_data ad[] = {
-	BT_DATA(BT_DATA_SVC_DATA16, service_data, sizeof(service_data)),
+	BT_DATA(BT_DATA_SVC_DATA16, (uint8_t *)&service_data, sizeof(service_data)),
 };
 
 static struct bt_le_ext_adv *adv;
@@ -49,11 +54,15 @@ int ble_init(void) {
 
     LOG_INF("Setting custom mac addr to: %s", CONFIG_BLE_USER_DEFINED_MAC_ADDR);
     RET_IF_ERR(bt_addr_le_from_str(&CONFIG_BLE_USER_DEFINED_MAC_ADDR, "random", &addr), "Unable to converte mac addr");
+#if defined(CONFIG_SENSORS_EMULATED) && defined(CONFIG_BOARD_NRF52_BSIM)
+    /* One address per simulated device (addr.a.val is little endian) */
+    addr.a.val[0] = get_device_nbr() & 0xff;
+    addr.a.val[1] = (get_device_nbr() >> 8) & 0xff;
+#endif
     RET_IF_ERR(bt_id_create(&addr, NULL), "Unable to set mac addr");
 
-    /* Setting service UUID */
-    service_data[0] = SERVICE_UUID_1;
-    service_data[1] = SERVICE_UUID_2;
+    /* Setting service UUID and format version */
+    payload_init(&service_data);
 
     isInisialized = true;
     LOG_INF("Bluetooth initialized");
@@ -62,46 +71,30 @@ int ble_init(void) {
 }
 
 /**
- * @brief quickly encode a pair of float values into the service data
+ * @brief Encode the data into the service data
  * 
- * @param pos position in the service data array
- * @param id id of the value
- * @param val value to encode
+ * @param sensors_data data to encode
  * 
  * @return int 0 if no error, error code otherwise
 */
-static int ble_encode_pair(uint8_t pos, uint8_t id, float *val) {
-    uint8_t whole, decimal;
+int ble_encode_adv_data(sensors_data_t *sensors_data) {
 
-    RET_IF_ERR(floatSeparator(val, &whole, &decimal), "Unable to separate float");
+    /* Setting counter and data (layout of payload.h) */
+    payload_encode(&service_data, counter, sensors_data);
 
-    service_data[pos] = id;
-    service_data[pos + 1] = whole;
-    service_data[pos + 2] = decimal;
+    /* The age is set when the advertising starts */
+    sample_ms = sensors_data->time_ms;
 
     return 0;
 }
 
 /**
- * @brief Encode the data into the service data
- * 
- * @param sensors_data data to encode
+ * @brief Encode the time elapsed since the reading into the service data
  * 
  * @return int 0 if no error, error code otherwise
 */
-int ble_encode_adv_data(sensors_data_t *sensors_data) {
-
-    /* Setting counter */
-    service_data[2] = 0;
-    service_data[3] = counter;
-
-    /* Setting data */
-    RET_IF_ERR(ble_encode_pair(4, TEMP_ID, &sensors_data->temp), "Unable to encode temperature");
-    RET_IF_ERR(ble_encode_pair(7, HUM_ID, &sensors_data->hum), "Unable to encode humidity");
-    RET_IF_ERR(ble_encode_pair(10, LUM_ID, &sensors_data->lum), "Unable to encode luminosity");
-    RET_IF_ERR(ble_encode_pair(13, GND_TEMP_ID, &sensors_data->gnd_temp), "Unable to encode ground temperature");
-    RET_IF_ERR(ble_encode_pair(16, GND_HUM_ID, &sensors_data->gnd_hum), "Unable to encode ground humidity");
-    RET_IF_ERR(ble_encode_pair(19, BAT_ID, &sensors_data->bat), "Unable to encode battery");
+static int ble_encode_age(void) {
+    payload_encode_sample_age(&service_data, (k_uptime_get() - sample_ms) / 1000.0f);
 
     return 0;
 }
@@ -117,6 +110,8 @@ static void ble_adv_start(int err) {
 
     RET_IF_ERR(bt_le_ext_adv_create(&adv_param, NULL, &adv), "Advertising failed to create");
 
+    RET_IF_ERR(ble_encode_age(), "Unable to encode sample age");
+
     RET_IF_ERR(bt_le_ext_adv_set_data(adv, ad, ARRAY_SIZE(ad), NULL, 0), "Advertising failed to set data");
 
     RET_IF_ERR(bt_le_ext_adv_start(adv, BT_LE_EXT_ADV_START_DEFAULT), "Advertising failed to start");
@@ -124,7 +119,19 @@ static void ble_adv_start(int err) {
     LOG_INF("Advertising started for %d seconds", CONFIG_BLE_ADV_DURATION_SEC);
 
     /* Wait for advertising to end */
-    k_sleep(K_SECONDS(CONFIG_BLE_ADV_DURATION_SEC));
+    int64_t end_ms = k_uptime_get() + CONFIG_BLE_ADV_DURATION_SEC * 1000;
+#if CONFIG_BLE_AGE_REFRESH_MS > 0
+    /* Keep the advertised age up to date (the counter does not change) */
+    while (k_uptime_get() + CONFIG_BLE_AGE_REFRESH_MS < end_ms) {
+        k_sleep(K_MSEC(CONFIG_BLE_AGE_REFRESH_MS));
+        RET_IF_ERR(ble_encode_age(), "Unable to encode sample age");
+        RET_IF_ERR(bt_le_ext_adv_set_data(adv, ad, ARRAY_SIZE(ad), NULL, 0), "Advertising failed to update data");
+    }
+#endif
+    int64_t left_ms = end_ms - k_uptime_get();
+    if (left_ms > 0) {
+        k_sleep(K_MSEC(left_ms));
+    }
 
     /* Stop advertising */
     RET_IF_ERR(bt_le_ext_adv_stop(adv), "Advertising failed to stop");
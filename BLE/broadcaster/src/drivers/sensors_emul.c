@@ -0,0 +1,70 @@
+/**
+ * sensors_emul.c
+ * 
+ * Emulated sensors, used instead of adc.c and aht20.c when
+ * CONFIG_SENSORS_EMULATED is set (e.g. for BabbleSim)
+ * 
+*/
+#include "adc.h"
+#include "aht20.h"
+#include <zephyr/random/rand32.h>
+
+LOG_MODULE_REGISTER(SENSORS_EMUL, CONFIG_ADC_LOG_LEVEL); /* Register the module for log */
+
+/**
+ * @brief Slow triangle wave with a bit of noise
+ * 
+ * @param min Minimum value
+ * @param max Maximum value
+ * @param period_s Period of the wave in seconds
+ * 
+ * @return The emulated value
+*/
+static float emulated_value(float min, float max, uint32_t period_s) {
+    uint32_t period_ms = period_s * 1000;
+    uint32_t t = (uint32_t)(k_uptime_get() % period_ms);
+    float ratio = (float)t / period_ms;
+
+    if(ratio > 0.5f) {
+        ratio = 1.0f - ratio;
+    }
+
+    float noise = (float)(sys_rand32_get() % 100) / 1000.0f;
+
+    return min + (max - min) * (2.0f * ratio) + noise;
+}
+
+int adc_init(void) {
+    LOG_INF("emulated sensors");
+    return 0;
+}
+
+int aht20_init(void) {
+    return 0;
+}
+
+int aht20_read(float *temperature, float *humidity) {
+    *temperature = emulated_value(18.0f, 30.0f, 3600);
+    *humidity = emulated_value(40.0f, 80.0f, 5400);
+    return 0;
+}
+
+int ground_humidity_read(float *humidity) {
+    *humidity = emulated_value(20.0f, 60.0f, 7200);
+    return 0;
+}
+
+int ground_temperature_read(float *temperature) {
+    *temperature = emulated_value(15.0f, 25.0f, 7200);
+    return 0;
+}
+
+int luminosity_read(float *luminosity) {
+    *luminosity = emulated_value(0.0f, 100.0f, 86400);
+    return 0;
+}
+
+int battery_voltage_read(float *voltage) {
+    *voltage = emulated_value(2.9f, 3.0f, 86400);
+    return 0;
+}
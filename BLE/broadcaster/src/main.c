@@ -12,6 +12,9 @@
 #include "drivers/aht20.h"
 #include "drivers/ble.h"
 #include "utils.h"
+#if defined(CONFIG_SENSORS_EMULATED)
+#include <zephyr/random/rand32.h>
+#endif
 
 LOG_MODULE_REGISTER(MAIN, CONFIG_MAIN_LOG_LEVEL);
 
@@ -21,7 +24,8 @@ sensors_data_t sensors_data = {
 	.lum = 0,
 	.gnd_temp = 0,
 	.gnd_hum = 0,
-	.bat = 0
+	.bat = 0,
+	.time_ms = 0
 };
 
 bool first_run = true;
@@ -40,6 +44,8 @@ static void read(void) {
 		RET_IF_ERR(ground_humidity_read(&sensors_data.gnd_hum), "Unable to read ground humidity");
 		// Read the battery level
 		RET_IF_ERR(battery_voltage_read(&sensors_data.bat), "Unable to read battery level");
+		// Keep the time of the reading, its age is advertised
+		sensors_data.time_ms = k_uptime_get();
 }
 
 /**
@@ -66,6 +72,11 @@ void main(void) {
 	// Initialize the BLE driver
 	RET_IF_ERR(ble_init(), "Unable to initialize BLE");
 
+#if defined(CONFIG_SENSORS_EMULATED)
+	// Spread the emulated nodes over the measurement period
+	k_sleep(K_MSEC(sys_rand32_get() % (CONFIG_SENSOR_SLEEP_DURATION_SEC * 1000)));
+#endif
+
 	while(true) {
 		// Read the sensors data
 		read();
@@ -31,6 +31,7 @@ typedef struct {
 	float gnd_temp;
 	float gnd_hum;
 	float bat;
+	int64_t time_ms; /* k_uptime_get() of the reading */
 } sensors_data_t;
 
 float mapRange(float value, float inMin, float inMax, float outMin, float outMax);
@@ -0,0 +1,147 @@
+import argparse
+import csv
+import glob
+import json
+import os
+import re
+
+# BabbleSim prefixes every console line with the device number and the simulated time
+LINE_RE = re.compile(r'^d_(\d+): @(\d+):(\d+):(\d+\.\d+)\s+(.*)$')
+ADV_RE = re.compile(r'Starting advertising #(\d+)')
+
+# Samples started this close to the end of the simulation are not counted
+END_MARGIN_S = 3.0
+
+# Service UUID of the broadcaster, as hex bytes of the data lines
+with open(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'payload', 'payload.json')) as f:
+    _uuid = json.load(f)['service_uuid']
+SERVICE_UUID = [_uuid[0:2], _uuid[2:4]]
+
+
+def parse_lines(path):
+    """
+    Read a BabbleSim console output
+
+    Args:
+        path (str): The log file
+
+    Returns:
+        list: (time in seconds, text) for each line
+    """
+    lines = []
+    with open(path, errors='replace') as f:
+        for raw in f:
+            match = LINE_RE.match(raw.rstrip())
+            if match is None:
+                continue
+            hours, minutes, seconds = int(match[2]), int(match[3]), float(match[4])
+            lines.append((hours * 3600 + minutes * 60 + seconds, match[5]))
+    return lines
+
+
+def broadcaster_addr(device_nbr: int) -> str:
+    '''Address given by the broadcaster to a simulated device (see ble_init)'''
+    return f'F0:CA:F0:CA:{(device_nbr >> 8) & 0xff:02X}:{device_nbr & 0xff:02X}'
+
+
+def percentile(values, p):
+    '''Nearest rank percentile of a sorted list'''
+    if not values:
+        return float('nan')
+    return values[min(len(values) - 1, int(p / 100 * len(values)))]
+
+
+def analyze(run_dir, nodes, sim_seconds):
+    """
+    Compute the benchmark results of one run
+
+    Args:
+        run_dir (str): The folder with central.log, central.time and broadcaster_N.log
+        nodes (int): The number of broadcasters
+        sim_seconds (float): The simulated duration
+
+    Returns:
+        dict: The results
+    """
+    # Samples sent: (addr, counter) -> list of start times (the counter wraps)
+    samples = {}
+    for path in glob.glob(os.path.join(run_dir, 'broadcaster_*.log')):
+        device_nbr = int(re.search(r'broadcaster_(\d+)\.log$', path)[1])
+        addr = broadcaster_addr(device_nbr)
+        for t, text in parse_lines(path):
+            match = ADV_RE.search(text)
+            if match and t < sim_seconds - END_MARGIN_S:
+                samples.setdefault((addr, int(match[1]) & 0xff), []).append(t)
+
+    # Lines forwarded by the central
+    first_seen = {}
+    forwarded = 0
+    for t, text in parse_lines(os.path.join(run_dir, 'central.log')):
+        if not text.startswith('{') or not text.endswith('}'):
+            continue
+        val = text.strip('{}').split(',')
+        if len(val) < 3: # {name,addr,data[,rssi,rx_ms]}
+            continue
+        data = val[2].split('-')
+        if len(data) < 4 or data[0:2] != SERVICE_UUID:
+            continue
+        forwarded += 1
+
+        key = (val[1].split(' ')[0].upper(), int(data[3], 16))
+        starts = samples.get(key)
+        if not starts:
+            continue
+        # Match the last sample started before this line
+        start = max((s for s in starts if s <= t), default=None)
+        if start is not None and (key, start) not in first_seen:
+            first_seen[(key, start)] = t - start
+
+    sent = sum(len(starts) for starts in samples.values())
+    delivered = len(first_seen)
+    latencies = sorted(first_seen.values())
+
+    cpu_s = float('nan')
+    time_path = os.path.join(run_dir, 'central.time')
+    if os.path.exists(time_path):
+        with open(time_path) as f:
+            user, system = f.read().split()[-2:]
+            cpu_s = float(user) + float(system)
+
+    return {
+        'nodes': nodes,
+        'samples_sent': sent,
+        'samples_delivered': delivered,
+        'delivery_ratio': delivered / sent if sent else float('nan'),
+        'lines_forwarded': forwarded,
+        'duplicates_forwarded': forwarded - delivered,
+        'latency_p50_ms': percentile(latencies, 50) * 1000,
+        'latency_p95_ms': percentile(latencies, 95) * 1000,
+        'latency_max_ms': (latencies[-1] if latencies else float('nan')) * 1000,
+        'central_host_cpu_s_per_sim_s': cpu_s / sim_seconds,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Results of a BabbleSim scale run')
+    parser.add_argument('run_dir')
+    parser.add_argument('--nodes', type=int, required=True)
+    parser.add_argument('--sim-seconds', type=float, required=True)
+    parser.add_argument('--results', help='CSV file the results are appended to')
+    args = parser.parse_args()
+
+    results = analyze(args.run_dir, args.nodes, args.sim_seconds)
+
+    for key, value in results.items():
+        print(f'{key:>30}: {value:.3f}' if isinstance(value, float) else f'{key:>30}: {value}')
+
+    if args.results:
+        is_new = not os.path.exists(args.results)
+        with open(args.results, 'a', newline='') as f:
+            writer = csv.DictWriter(f, fieldnames=list(results))
+            if is_new:
+                writer.writeheader()
+            writer.writerow(results)
+
+
+if __name__ == '__main__':
+    main()
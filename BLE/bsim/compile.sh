@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+# Build the broadcaster and the central for nrf52_bsim
+#
+# Needs ZEPHYR_BASE, BSIM_OUT_PATH and BSIM_COMPONENTS_PATH (see the BabbleSim
+# documentation of Zephyr). The executables are copied in ${BSIM_OUT_PATH}/bin.
+#
+# Extra arguments are passed to CMake for both builds, e.g.:
+#   ./compile.sh -DCONFIG_SCAN_SCHED=n
+
+set -e
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set}"
+: "${BSIM_COMPONENTS_PATH:?BSIM_COMPONENTS_PATH must be set}"
+
+HERE="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+BUILD_DIR="${BUILD_DIR:-${HERE}/build}"
+
+west build -p auto -b nrf52_bsim -d "${BUILD_DIR}/broadcaster" "${HERE}/../broadcaster" -- \
+	-DCONF_FILE="${HERE}/broadcaster.conf" "$@"
+cp "${BUILD_DIR}/broadcaster/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_nrf52_serreiot_broadcaster"
+
+west build -p auto -b nrf52_bsim -d "${BUILD_DIR}/central" "${HERE}/../central-nrf" -- \
+	-DCONF_FILE="${HERE}/central.conf" "$@"
+cp "${BUILD_DIR}/central/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_nrf52_serreiot_central"
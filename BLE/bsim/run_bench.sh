@@ -0,0 +1,56 @@
+#!/usr/bin/env bash
+# Run the scale benchmark: one central and N broadcasters, for each N given
+#
+#   ./run_bench.sh 50 200 500
+#
+# SIM_SECONDS (default 120) is the simulated duration and SEED (default 1)
+# the random seed, so two runs with the same values give the same result.
+# The results are appended to results.csv (one line per N).
+
+set -e
+
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set}"
+
+HERE="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+SIM_SECONDS="${SIM_SECONDS:-120}"
+SEED="${SEED:-1}"
+OUT_DIR="${OUT_DIR:-${HERE}/out}"
+RESULTS="${RESULTS:-${HERE}/results.csv}"
+
+BIN="${BSIM_OUT_PATH}/bin"
+CENTRAL="${BIN}/bs_nrf52_serreiot_central"
+BROADCASTER="${BIN}/bs_nrf52_serreiot_broadcaster"
+
+if [ $# -eq 0 ]; then
+	set -- 50 200 500
+fi
+
+for N in "$@"; do
+	SIM_ID="serreiot_${N}_${SEED}"
+	RUN_DIR="${OUT_DIR}/${N}"
+	rm -rf "${RUN_DIR}" && mkdir -p "${RUN_DIR}"
+	echo "Running ${N} broadcasters for ${SIM_SECONDS} s"
+
+	pids=()
+	(cd "${BIN}" && ./bs_2G4_phy_v1 -s="${SIM_ID}" -D=$((N + 1)) -rs="${SEED}" \
+		-sim_length=$((SIM_SECONDS * 1000000)) > "${RUN_DIR}/phy.log" 2>&1) &
+	pids+=($!)
+
+	# Host CPU time of the central, the simulated CPU time is always 0
+	(cd "${BIN}" && /usr/bin/time -f "%U %S" -o "${RUN_DIR}/central.time" \
+		"${CENTRAL}" -s="${SIM_ID}" -d=0 -rs=$((SEED + 1000)) > "${RUN_DIR}/central.log" 2>&1) &
+	pids+=($!)
+
+	for i in $(seq 1 "${N}"); do
+		(cd "${BIN}" && "${BROADCASTER}" -s="${SIM_ID}" -d="${i}" -rs=$((SEED + i)) \
+			> "${RUN_DIR}/broadcaster_${i}.log" 2>&1) &
+		pids+=($!)
+	done
+
+	for pid in "${pids[@]}"; do
+		wait "${pid}"
+	done
+
+	python3 "${HERE}/analyze.py" --nodes "${N}" --sim-seconds "${SIM_SECONDS}" \
+		--results "${RESULTS}" "${RUN_DIR}"
+done
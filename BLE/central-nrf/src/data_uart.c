@@ -0,0 +1,277 @@
+/**
+ * data_uart.c
+ * 
+ * Dedicated CDC ACM channel used only for the sensor data sent to the host.
+ * The shell and the logs stay on the console, so the host reads a stream that
+ * only contains data lines.
+ * 
+ * Lines are written by threads (one at a time, under a mutex) into a ring
+ * buffer that is emptied by the UART interrupt. With one producer and one
+ * consumer the ring buffer needs no other lock.
+ * 
+*/
+
+#include "data_uart.h"
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/ring_buffer.h>
+
+LOG_MODULE_REGISTER(DATA_UART, CONFIG_DATA_UART_LOG_LEVEL);
+
+#define HEX_CHUNK 16 /* Bytes hex encoded at a time */
+#define DROP_LINE_MAX 18 /* %drop,4294967295\n */
+
+#if DT_HAS_CHOSEN(serreiot_data_uart)
+
+static const struct device *const data_dev = DEVICE_DT_GET(DT_CHOSEN(serreiot_data_uart));
+
+RING_BUF_DECLARE(tx_ring, CONFIG_DATA_UART_TX_BUF_SIZE);
+
+static uint32_t dropped_reported; /* Value of dropped in the last %drop line */
+static bool full; /* Lines are dropped until the host reads the channel again */
+
+#endif
+
+static K_MUTEX_DEFINE(line_lock);
+
+static uint32_t dropped;
+
+#if CONFIG_DATA_UART_TIME_PERIOD_SEC > 0
+static void time_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(time_work, time_handler);
+#endif
+
+#if DT_HAS_CHOSEN(serreiot_data_uart)
+/**
+ * @brief Interrupt handler, move the pending bytes from the ring buffer to the fifo
+ * 
+ * @param dev
+ * @param user_data
+ * @return static void
+*/
+static void data_uart_isr(const struct device *dev, void *user_data)
+{
+	ARG_UNUSED(user_data);
+
+	while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
+		if (uart_irq_rx_ready(dev)) {
+			uint8_t discard[16];
+
+			/* Nothing is expected from the host on this channel */
+			(void)uart_fifo_read(dev, discard, sizeof(discard));
+		}
+
+		if (uart_irq_tx_ready(dev)) {
+			uint8_t *chunk;
+			uint32_t len = ring_buf_get_claim(&tx_ring, &chunk, CONFIG_DATA_UART_TX_BUF_SIZE);
+
+			if (len == 0) {
+				uart_irq_tx_disable(dev);
+				continue;
+			}
+
+			int sent = uart_fifo_fill(dev, chunk, len);
+
+			ring_buf_get_finish(&tx_ring, MAX(sent, 0));
+		}
+	}
+}
+#endif
+
+#if CONFIG_DATA_UART_TIME_PERIOD_SEC > 0
+/**
+ * @brief Send the uptime on the data channel
+ * 
+ * Format: %time,uptime_ms
+ * 
+ * The host keeps the smallest difference between its clock and this uptime,
+ * the frames delayed by the buffer or by USB only give larger ones.
+ * 
+ * @param work
+*/
+static void time_handler(struct k_work *work)
+{
+	char line[32];
+	int len = snprintk(line, sizeof(line), "%%time,%lld\n", k_uptime_get());
+
+	if (len > 0 && len < sizeof(line)) {
+		(void)data_uart_write(line, len);
+	}
+
+	k_work_reschedule(k_work_delayable_from_work(work), K_SECONDS(CONFIG_DATA_UART_TIME_PERIOD_SEC));
+}
+#endif
+
+/**
+ * @brief Initialize the data channel
+ * 
+ * @return int 0 if successful, error code otherwise
+*/
+int data_uart_init(void)
+{
+#if DT_HAS_CHOSEN(serreiot_data_uart)
+	if (!device_is_ready(data_dev)) {
+		LOG_ERR("Data UART device not ready");
+		return -ENODEV;
+	}
+
+	int err = uart_irq_callback_set(data_dev, data_uart_isr);
+	if (err) {
+		return err;
+	}
+
+	uart_irq_rx_enable(data_dev);
+	LOG_INF("Data channel ready on %s", data_dev->name);
+#else
+	LOG_WRN("No data UART chosen, data is sent on the console");
+#endif
+#if CONFIG_DATA_UART_TIME_PERIOD_SEC > 0
+	k_work_reschedule(&time_work, K_NO_WAIT);
+#endif
+	return 0;
+}
+
+#if DT_HAS_CHOSEN(serreiot_data_uart)
+/**
+ * @brief Report the lines dropped while the channel was full (the lock must be held)
+ * 
+ * Format: %drop,lines
+*/
+static void report_dropped(void)
+{
+	char line[DROP_LINE_MAX + 1];
+	uint32_t lines = dropped - dropped_reported;
+	int len = snprintk(line, sizeof(line), "%%drop,%u\n", lines);
+
+	if (len > 0 && len < sizeof(line)) {
+		(void)ring_buf_put(&tx_ring, (const uint8_t *)line, len);
+	}
+	dropped_reported = dropped;
+	full = false;
+	LOG_INF("Data channel read again, %u lines dropped", lines);
+}
+#endif
+
+/**
+ * @brief Start a line of len bytes
+ * 
+ * The space of the whole line is checked first, so a line is either queued
+ * entirely or dropped and the host never receives a partial line. On success
+ * the caller must write exactly len bytes and call data_uart_line_end().
+ * 
+ * The drops are only logged when the channel gets full and when half of it is
+ * free again, the number of lines dropped is then sent before the next line.
+ * 
+ * @param len
+ * @return int 0 if successful, -ENOMEM if the line has to be dropped
+*/
+int data_uart_line_begin(size_t len)
+{
+	k_mutex_lock(&line_lock, K_FOREVER);
+
+#if DT_HAS_CHOSEN(serreiot_data_uart)
+	/* Once full, half the buffer must be free again, so a host reading slowly doesn't flap the state */
+	size_t needed = full ? MAX(len + DROP_LINE_MAX, CONFIG_DATA_UART_TX_BUF_SIZE / 2) : len;
+
+	if (ring_buf_space_get(&tx_ring) < needed) {
+		dropped++;
+		if (!full) {
+			full = true;
+			LOG_WRN("Data channel full, lines dropped until the host reads it");
+		}
+		k_mutex_unlock(&line_lock);
+		return -ENOMEM;
+	}
+
+	if (full) {
+		report_dropped();
+	}
+#endif
+	return 0;
+}
+
+/**
+ * @brief Add raw bytes to the current line
+ * 
+ * @param buf
+ * @param len
+*/
+void data_uart_line_put(const char *buf, size_t len)
+{
+#if DT_HAS_CHOSEN(serreiot_data_uart)
+	(void)ring_buf_put(&tx_ring, (const uint8_t *)buf, len);
+#else
+	printk("%.*s", (int)len, buf);
+#endif
+}
+
+/**
+ * @brief Add bytes to the current line as hex values separated by hyphens
+ * 
+ * @param data
+ * @param len
+*/
+void data_uart_line_put_hex(const uint8_t *data, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	char chunk[HEX_CHUNK * 3];
+
+	for (size_t i = 0; i < len; i += HEX_CHUNK) {
+		size_t n = MIN(len - i, HEX_CHUNK);
+		size_t pos = 0;
+
+		for (size_t j = 0; j < n; j++) {
+			if (i + j > 0) {
+				chunk[pos++] = '-';
+			}
+			chunk[pos++] = digits[data[i + j] >> 4];
+			chunk[pos++] = digits[data[i + j] & 0x0f];
+		}
+
+		data_uart_line_put(chunk, pos);
+	}
+}
+
+/**
+ * @brief Finish the current line and start sending it
+*/
+void data_uart_line_end(void)
+{
+#if DT_HAS_CHOSEN(serreiot_data_uart)
+	uart_irq_tx_enable(data_dev);
+#endif
+	k_mutex_unlock(&line_lock);
+}
+
+/**
+ * @brief Queue a complete line on the data channel
+ * 
+ * @param buf
+ * @param len
+ * @return int 0 if successful, -ENOMEM if the line was dropped
+*/
+int data_uart_write(const char *buf, size_t len)
+{
+	int err = data_uart_line_begin(len);
+	if (err) {
+		return err;
+	}
+
+	data_uart_line_put(buf, len);
+	data_uart_line_end();
+
+	return 0;
+}
+
+/**
+ * @brief Get the number of lines dropped because the buffer was full
+ * 
+ * @return uint32_t
+*/
+uint32_t data_uart_dropped(void)
+{
+	return dropped;
+}
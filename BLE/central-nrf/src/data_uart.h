@@ -0,0 +1,29 @@
+/**
+ * data_uart.h
+ * 
+ * Dedicated CDC ACM channel used only for the sensor data sent to the host
+ * 
+*/
+
+#ifndef DATA_UART_H_
+#define DATA_UART_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+int data_uart_init(void);
+
+int data_uart_write(const char *buf, size_t len);
+
+int data_uart_line_begin(size_t len);
+
+void data_uart_line_put(const char *buf, size_t len);
+
+void data_uart_line_put_hex(const uint8_t *data, size_t len);
+
+void data_uart_line_end(void);
+
+uint32_t data_uart_dropped(void);
+
+#endif /* DATA_UART_H_ */
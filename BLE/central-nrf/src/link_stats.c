@@ -0,0 +1,262 @@
+/**
+ * link_stats.c
+ * 
+ * Per node link statistics kept by the dongle. They can be read with the
+ * "stats" shell command and are optionally sent as summary frames on the
+ * data channel.
+ * 
+*/
+
+#include "link_stats.h"
+#include "data_uart.h"
+#include <stdio.h>
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+#include <zephyr/sys/printk.h>
+
+static struct link_stats_node nodes[CONFIG_LINK_STATS_MAX_NODES];
+
+static struct k_spinlock lock;
+
+#if CONFIG_LINK_STATS_SUMMARY_PERIOD_SEC > 0
+static void summary_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(summary_work, summary_handler);
+#endif
+
+/**
+ * @brief Find the entry of a node, or allocate one (evicting the oldest)
+ * 
+ * @param addr
+ * @return struct link_stats_node*
+*/
+static struct link_stats_node *find_or_alloc(const bt_addr_le_t *addr)
+{
+	struct link_stats_node *oldest = &nodes[0];
+
+	for (size_t i = 0; i < ARRAY_SIZE(nodes); i++) {
+		if (nodes[i].used && !bt_addr_le_cmp(&nodes[i].addr, addr)) {
+			return &nodes[i];
+		}
+
+		if (!nodes[i].used) {
+			oldest = &nodes[i];
+		} else if (oldest->used && nodes[i].last_rx_ms < oldest->last_rx_ms) {
+			oldest = &nodes[i];
+		}
+	}
+
+	(void)memset(oldest, 0, sizeof(*oldest));
+	bt_addr_le_copy(&oldest->addr, addr);
+	oldest->used = true;
+
+	return oldest;
+}
+
+/**
+ * @brief Record a received packet
+ * 
+ * @param addr address of the node
+ * @param seq advertising counter of the packet
+ * @param rssi
+ * @return bool true if the sequence number was not seen just before
+*/
+bool link_stats_update(const bt_addr_le_t *addr, uint8_t seq, int8_t rssi)
+{
+	int64_t now = k_uptime_get();
+	bool is_new = false;
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	struct link_stats_node *node = find_or_alloc(addr);
+
+	node->rx++;
+
+	/* Running RSSI mean and variance (Welford) */
+	float delta = rssi - node->rssi_mean;
+	node->rssi_mean += delta / node->rx;
+	node->rssi_m2 += delta * (rssi - node->rssi_mean);
+
+	uint8_t diff = seq - node->last_seq; /* Wrap aware on 8 bits */
+
+	if (node->unique == 0 || diff != 0) {
+		is_new = true;
+
+		if (node->unique > 0 && diff < 128) {
+			node->lost += diff - 1;
+
+			float iat = (float)(now - node->last_new_ms);
+			node->iat_count++;
+			node->iat_mean_ms += (iat - node->iat_mean_ms) / node->iat_count;
+
+			/* A gap spans several periods, divide by the counter difference */
+			float period = iat / diff;
+			if (node->iat_count == 1) {
+				node->period_ms = period;
+			} else {
+				node->period_ms += (period - node->period_ms) / 8;
+			}
+		}
+
+		node->unique++;
+		node->last_seq = seq;
+		node->last_new_ms = now;
+	}
+
+	node->last_rx_ms = now;
+	k_spin_unlock(&lock, key);
+
+	return is_new;
+}
+
+/**
+ * @brief Record a report whose chain of PDUs was incomplete
+ * 
+ * @param addr address of the node
+*/
+void link_stats_truncated(const bt_addr_le_t *addr)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	struct link_stats_node *node = find_or_alloc(addr);
+
+	node->truncated++;
+	node->last_rx_ms = k_uptime_get();
+	k_spin_unlock(&lock, key);
+}
+
+/**
+ * @brief Get the variance of the RSSI of a node
+ * 
+ * @param node
+ * @return float
+*/
+float link_stats_rssi_var(const struct link_stats_node *node)
+{
+	return node->rx > 1 ? node->rssi_m2 / (node->rx - 1) : 0.0f;
+}
+
+/**
+ * @brief Clear all the statistics
+*/
+void link_stats_reset(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	(void)memset(nodes, 0, sizeof(nodes));
+	k_spin_unlock(&lock, key);
+}
+
+/**
+ * @brief Copy the entry at index i
+ * 
+ * @param i index in the table (0 to CONFIG_LINK_STATS_MAX_NODES - 1)
+ * @param out
+ * @return bool true if the entry is used
+*/
+bool link_stats_get(size_t i, struct link_stats_node *out)
+{
+	if (i >= ARRAY_SIZE(nodes)) {
+		return false;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	*out = nodes[i];
+	k_spin_unlock(&lock, key);
+
+	return out->used;
+}
+
+#if CONFIG_LINK_STATS_SUMMARY_PERIOD_SEC > 0
+/**
+ * @brief Send one summary frame per node on the data channel
+ * 
+ * Format: %stats,addr,rx,unique,lost,rssi_mean,rssi_var,iat_ms,truncated
+ * 
+ * @param work
+*/
+static void summary_handler(struct k_work *work)
+{
+	struct link_stats_node node;
+	char addr[BT_ADDR_STR_LEN];
+	char line[128];
+
+	for (size_t i = 0; i < ARRAY_SIZE(nodes); i++) {
+		if (!link_stats_get(i, &node)) {
+			continue;
+		}
+
+		bt_addr_to_str(&node.addr.a, addr, sizeof(addr));
+		int len = snprintk(line, sizeof(line), "%%stats,%s,%u,%u,%u,%.1f,%.1f,%u,%u\n",
+				   addr, node.rx, node.unique, node.lost, (double)node.rssi_mean,
+				   (double)link_stats_rssi_var(&node), (uint32_t)node.iat_mean_ms,
+				   node.truncated);
+
+		if (len > 0 && len < sizeof(line)) {
+			(void)data_uart_write(line, len);
+		}
+	}
+
+	k_work_reschedule(k_work_delayable_from_work(work), K_SECONDS(CONFIG_LINK_STATS_SUMMARY_PERIOD_SEC));
+}
+#endif
+
+/**
+ * @brief Start the periodic summary frames (if enabled)
+*/
+void link_stats_init(void)
+{
+#if CONFIG_LINK_STATS_SUMMARY_PERIOD_SEC > 0
+	k_work_reschedule(&summary_work, K_SECONDS(CONFIG_LINK_STATS_SUMMARY_PERIOD_SEC));
+#endif
+}
+
+#if defined(CONFIG_SHELL)
+/**
+ * @brief Shell command: print the statistics of every node
+*/
+static int cmd_stats_show(const struct shell *sh, size_t argc, char **argv)
+{
+	struct link_stats_node node;
+	char addr[BT_ADDR_STR_LEN];
+	int64_t now = k_uptime_get();
+
+	shell_print(sh, "%-17s %8s %8s %6s %6s %7s %7s %8s %9s %8s", "address", "rx", "unique",
+		    "lost", "trunc", "rssi", "var", "iat_ms", "period_ms", "age_s");
+
+	for (size_t i = 0; i < ARRAY_SIZE(nodes); i++) {
+		if (!link_stats_get(i, &node)) {
+			continue;
+		}
+
+		bt_addr_to_str(&node.addr.a, addr, sizeof(addr));
+		shell_print(sh, "%-17s %8u %8u %6u %6u %7.1f %7.1f %8u %9u %8u", addr, node.rx,
+			    node.unique, node.lost, node.truncated, (double)node.rssi_mean,
+			    (double)link_stats_rssi_var(&node), (uint32_t)node.iat_mean_ms, (uint32_t)node.period_ms,
+			    (uint32_t)((now - node.last_rx_ms) / 1000));
+	}
+
+	shell_print(sh, "lines dropped on the data channel: %u", data_uart_dropped());
+
+	return 0;
+}
+
+/**
+ * @brief Shell command: clear the statistics
+*/
+static int cmd_stats_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	link_stats_reset();
+	shell_print(sh, "Statistics cleared");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(stats_cmds,
+	SHELL_CMD(show, NULL, "Show the link statistics of every node", cmd_stats_show),
+	SHELL_CMD(reset, NULL, "Clear the link statistics", cmd_stats_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(stats, &stats_cmds, "Per node link statistics", NULL);
+
+#endif /* CONFIG_SHELL */
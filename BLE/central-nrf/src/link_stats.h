@@ -0,0 +1,44 @@
+/**
+ * link_stats.h
+ * 
+ * Per node link statistics kept by the dongle
+ * 
+*/
+
+#ifndef LINK_STATS_H_
+#define LINK_STATS_H_
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/addr.h>
+
+struct link_stats_node {
+	bt_addr_le_t addr;
+	bool used;
+	uint32_t rx;            /* Packets received, duplicates included */
+	uint32_t unique;        /* Distinct sequence numbers received */
+	uint32_t lost;          /* Sequence numbers skipped (loss estimate) */
+	uint32_t truncated;     /* Reports with an incomplete chain */
+	uint8_t last_seq;
+	int64_t last_rx_ms;     /* Uptime of the last packet */
+	int64_t last_new_ms;    /* Uptime of the last new sequence number */
+	float rssi_mean;        /* Running mean of the RSSI (dBm) */
+	float rssi_m2;          /* Sum of squared differences (Welford) */
+	float iat_mean_ms;      /* Mean time between two new sequence numbers */
+	uint32_t iat_count;
+	float period_ms;        /* Estimated time between two counters (EWMA) */
+};
+
+void link_stats_init(void);
+
+bool link_stats_update(const bt_addr_le_t *addr, uint8_t seq, int8_t rssi);
+
+void link_stats_truncated(const bt_addr_le_t *addr);
+
+bool link_stats_get(size_t i, struct link_stats_node *out);
+
+float link_stats_rssi_var(const struct link_stats_node *node);
+
+void link_stats_reset(void);
+
+#endif /* LINK_STATS_H_ */
@@ -7,6 +7,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
@@ -16,6 +17,10 @@ LOG_MODULE_REGISTER(MAIN, CONFIG_MAIN_LOG_LEVEL);
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/hci.h>
 
+#include "data_uart.h"
+#include "link_stats.h"
+#include "scan_sched.h"
+
 #define STRING(x) #x
 #define TO_STRING(x) STRING(x)
 #define LOCATION __FILE__ ":" TO_STRING(__LINE__)
@@ -28,95 +33,165 @@ LOG_MODULE_REGISTER(MAIN, CONFIG_MAIN_LOG_LEVEL);
 	}
 
 #define NAME_LEN 30
-#define DATA_LEN 30
+#define MAX_SVC_FRAGMENTS 8 /* Service data AD structures concatenated for one report */
+
+#define SERVICE_UUID_1 0xab
+#define SERVICE_UUID_2 0xcd
+#define UUID_LEN 2
+#define COUNTER_POS 3 /* Position of the advertising counter in the service data */
 
-typedef struct service_data {
-		uint8_t len;
-		uint8_t data[DATA_LEN];
+/* Service data of a report, pointing into the scan buffer (no copy) */
+struct service_data {
+	const uint8_t *frag[MAX_SVC_FRAGMENTS];
+	uint8_t frag_len[MAX_SVC_FRAGMENTS];
+	uint8_t count;
+	uint16_t len;     /* Total length, UUID included once */
+	bool truncated;   /* An AD structure runs past the end of the report */
 };
 
 /**
- * @brief Convert an array of bytes to a string of hex values separated by hyphens
+ * @brief Walk the AD structures of a report once, keeping the name and pointers to the service data
  * 
- * @param array
- * @param length
- * @param result
- * @param resultSize
- * @return int 0 if successful, 1 if error
- */
-int convertArray(uint8_t* array, size_t length, char* result, size_t resultSize)
+ * Service data can be split over several Service Data AD structures with the
+ * same UUID (each one is limited to 254 bytes), they are concatenated with the
+ * UUID kept once. A structure longer than what is left in the buffer means the
+ * chain of extended advertising PDUs was incomplete, the first bytes of a cut
+ * service data are still kept in frag[0] (count stays 0).
+ * 
+ * @param buf
+ * @param name
+ * @param svc_data
+ * @return static void
+*/
+static void parse_report(const struct net_buf_simple *buf, char *name, struct service_data *svc_data)
 {
-    size_t currentIndex = 0;
-    for (size_t i = 0; i < length; i++) {
-        int bytesWritten = snprintf(result + currentIndex, resultSize - currentIndex, "%02x-", array[i]);
-        if (bytesWritten < 0 || bytesWritten >= resultSize - currentIndex) {
-            return 1;
-        }
-        currentIndex += bytesWritten;
-    }
-
-    result[currentIndex - 1] = '\0'; // Replace the last hyphen with a null terminator
-	return 0;
+	const uint8_t *p = buf->data;
+	uint16_t left = buf->len;
+
+	while (left > 1) {
+		uint8_t len = p[0];
+
+		if (len == 0) {
+			break; // Early termination of the data
+		}
+
+		if (len + 1 > left) {
+			/* Keep the start of a cut service data, its UUID tells whose report it is */
+			if (svc_data->frag_len[0] == 0 && p[1] == BT_DATA_SVC_DATA16) {
+				svc_data->frag[0] = &p[2];
+				svc_data->frag_len[0] = left - 2;
+			}
+			svc_data->truncated = true;
+			break;
+		}
+
+		uint8_t type = p[1];
+		const uint8_t *data = &p[2];
+		uint8_t data_len = len - 1;
+
+		switch (type) {
+		case BT_DATA_NAME_SHORTENED:
+		case BT_DATA_NAME_COMPLETE:
+			if (name[0] == '\0') {
+				uint8_t name_len = MIN(data_len, NAME_LEN - 1);
+				(void)memcpy(name, data, name_len);
+				name[name_len] = '\0';
+			}
+			break;
+		case BT_DATA_SVC_DATA16: // 16-bit UUID
+			if (svc_data->count == 0) {
+				svc_data->frag[0] = data;
+				svc_data->frag_len[0] = data_len;
+				svc_data->len = data_len;
+				svc_data->count = 1;
+			} else if (data_len > UUID_LEN && svc_data->count < MAX_SVC_FRAGMENTS &&
+				   svc_data->frag_len[0] >= UUID_LEN && !memcmp(data, svc_data->frag[0], UUID_LEN)) {
+				/* Continuation of the same service, skip its UUID */
+				svc_data->frag[svc_data->count] = data + UUID_LEN;
+				svc_data->frag_len[svc_data->count] = data_len - UUID_LEN;
+				svc_data->len += data_len - UUID_LEN;
+				svc_data->count++;
+			}
+			break;
+		default:
+			break;
+		}
+
+		p += len + 1;
+		left -= len + 1;
+	}
 }
 
 /**
- * @brief Send value to computer
+ * @brief Check if the service data is ours (service UUID of the broadcasters)
  * 
- * @param name
- * @param addr
- * @param srv_data
- * @return static void
+ * @param svc_data
+ * @return bool
 */
-static void send_value(char* name, char* addr, struct service_data* srv_data)
+static bool is_our_service(const struct service_data *svc_data)
 {
-    char data[DATA_LEN * 3];
-    RET_IF_ERR(convertArray(srv_data->data, srv_data->len, data, sizeof(data)), "Error converting data to string\n"); // Convert data to string
-
-	printk("{%s,%s,%s}\n", name, addr, data); // Print name, address, and converted data
+	return svc_data->frag_len[0] >= UUID_LEN &&
+	       svc_data->frag[0][0] == SERVICE_UUID_1 && svc_data->frag[0][1] == SERVICE_UUID_2;
 }
 
 /**
- * @brief Callback function for name
+ * @brief Send value to computer
+ * 
+ * The service data is hex encoded straight into the data channel buffer.
  * 
- * @param data
- * @param user_data
- * @return static bool
+ * @param name
+ * @param addr
+ * @param svc_data
+ * @param rssi
+ * @param rx_ms k_uptime_get() of the reception
+ * @return static void
 */
-static bool data_cb_name(struct bt_data *data, void *user_data)
+static void send_value(const char *name, const char *addr, const struct service_data *svc_data,
+		       int8_t rssi, int64_t rx_ms)
 {
-	char *name = user_data;
-	uint8_t len;
-
-	switch (data->type) {
-	case BT_DATA_NAME_SHORTENED:
-	case BT_DATA_NAME_COMPLETE:
-		len = MIN(data->data_len, NAME_LEN - 1);
-		(void)memcpy(name, data->data, len);
-		name[len] = '\0';
-		return false;
-	default:
-		return true;
+	char tail[32];
+	size_t name_len = strlen(name);
+	size_t addr_len = strlen(addr);
+	size_t tail_len = snprintk(tail, sizeof(tail), ",%d,%lld", rssi, rx_ms);
+	size_t len = name_len + addr_len + svc_data->len * 3 - 1 + tail_len + 5; // {name,addr,xx-..-xx,rssi,rx_ms}\n
+
+	if (data_uart_line_begin(len)) {
+		return; // Counted and reported by the data channel
+	}
+
+	data_uart_line_put("{", 1);
+	data_uart_line_put(name, name_len);
+	data_uart_line_put(",", 1);
+	data_uart_line_put(addr, addr_len);
+	data_uart_line_put(",", 1);
+	for (uint8_t i = 0; i < svc_data->count; i++) {
+		if (i > 0) {
+			data_uart_line_put("-", 1);
+		}
+		data_uart_line_put_hex(svc_data->frag[i], svc_data->frag_len[i]);
 	}
+	data_uart_line_put(tail, tail_len);
+	data_uart_line_put("}\n", 2);
+
+	data_uart_line_end();
 }
 
 /**
- * @brief Callback function for service data
+ * @brief Report a truncated chain on the data channel
+ * 
+ * Format: %trunc,addr,received_len
  * 
- * @param data
- * @param user_data
- * @return static bool
+ * @param addr
+ * @param received_len
+ * @return static void
 */
-static bool data_cb_service(struct bt_data *data, void *user_data){
-	struct service_data *svc_data = user_data;
-
-	switch (data->type) { // Get service data
-	case BT_DATA_SVC_DATA16:  // 16-bit UUID
-		svc_data->len = MIN(data->data_len, DATA_LEN - 1);
-		(void)memcpy(svc_data->data, data->data, svc_data->len);
-		svc_data->data[svc_data->len] = '\0';
-		return false;
-	default:
-		return true;
+static void send_truncated(const char *addr, uint16_t received_len)
+{
+	char line[BT_ADDR_LE_STR_LEN + 16];
+	int len = snprintk(line, sizeof(line), "%%trunc,%s,%u\n", addr, received_len);
+
+	if (len > 0 && len < sizeof(line)) {
+		(void)data_uart_write(line, len);
 	}
 }
 
@@ -131,30 +206,39 @@ static bool data_cb_service(struct bt_data *data, void *user_data){
 static void scan_recv(const struct bt_le_scan_recv_info *info,
 		      struct net_buf_simple *buf)
 {
+	int64_t rx_ms = k_uptime_get();
 	char le_addr[BT_ADDR_LE_STR_LEN];
-	char name[NAME_LEN];
-	struct net_buf_simple ad;
-	struct service_data svc_data = {
-		.len = 0,
-		.data = {0},
-	};
+	char name[NAME_LEN] = {0};
+	struct service_data svc_data = {0};
 
-	(void)memset(name, 0, sizeof(name)); // Clear name
+	parse_report(buf, name, &svc_data); // Get name and service data
 
-	(void)memcpy(&ad, buf, sizeof(ad)); // Copy buffer
-
-	bt_data_parse(&ad, data_cb_name, name); // Get name
+	if (svc_data.truncated) { // Incomplete chain, do not forward partial data
+		if (!is_our_service(&svc_data)) {
+			return; // Other advertisers, not counted so they can't evict the nodes from the link statistics
+		}
+		bt_addr_to_str(&info->addr->a, le_addr, sizeof(le_addr));
+		link_stats_truncated(info->addr);
+		LOG_WRN("Truncated report from %s (%u bytes)", le_addr, buf->len);
+		send_truncated(le_addr, buf->len);
+		return;
+	}
 
 	if (name[0] == '\0') return; // If no name, ignore
 
-	bt_data_parse(buf, data_cb_service, &svc_data); // Get service data
+	if (svc_data.len < 1) return; // If no service data, ignore
 
-	if (svc_data.len < 1) return; // If no service data, ignore)
+	const uint8_t *svc = svc_data.frag[0];
+	if (svc_data.frag_len[0] > COUNTER_POS && is_our_service(&svc_data)) {
+		if (link_stats_update(info->addr, svc[COUNTER_POS], info->rssi)) { // Update the link statistics
+			IF_ENABLED(CONFIG_SCAN_SCHED, (scan_sched_notify();)) // New counter, let the scheduler adapt
+		}
+	}
 	
 	bt_addr_to_str(&info->addr->a, le_addr, sizeof(le_addr)); // Get address
 
-	LOG_INF("Received data from %s (%s)\n", le_addr, name);
-	send_value(name, le_addr, &svc_data); // Send data to computer
+	LOG_DBG("Received %u bytes from %s (%s)", svc_data.len, le_addr, name);
+	send_value(name, le_addr, &svc_data, info->rssi, rx_ms); // Send data to computer
 }
 
 static struct bt_le_scan_cb scan_callbacks = { 
@@ -163,12 +247,19 @@ static struct bt_le_scan_cb scan_callbacks = {
 
 void main(void)
 {
+	RET_IF_ERR(data_uart_init(), "Data channel init failed\n"); // Initialize the data channel
+
+	link_stats_init(); // Start the periodic link statistics
+
 	RET_IF_ERR(bt_enable(NULL), "Bluetooth init failed\n"); // Initialize Bluetooth
 	
 	bt_le_scan_cb_register(&scan_callbacks); // Register scan callback
 
 	LOG_INF("Bluetooth initialized\n");
 
+#if defined(CONFIG_SCAN_SCHED)
+	RET_IF_ERR(scan_sched_start(), "Scanning failed to start\n"); // Start scanning, the window follows the nodes
+#else
 	struct bt_le_scan_param scan_param = { // Set scan parameters
 		.type       = BT_LE_SCAN_TYPE_PASSIVE,
 		.options    = BT_LE_SCAN_OPT_NONE,
@@ -177,5 +268,6 @@ void main(void)
 	};
 
 	RET_IF_ERR(bt_le_scan_start(&scan_param, NULL), "Scanning failed to start\n"); // Start scanning
+#endif
 	LOG_INF("Scanning successfully started\n"); 
 }
@@ -0,0 +1,148 @@
+/**
+ * scan_sched.c
+ * 
+ * Adaptive scan scheduler. The period and the phase of every node are learned
+ * from the arrival of new counters (see link_stats). Around the expected
+ * arrival of a node the scan runs at 100% duty, elsewhere it backs off to a
+ * discovery floor so new nodes are still found.
+ * 
+*/
+
+#include "scan_sched.h"
+#include "link_stats.h"
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(SCAN_SCHED, CONFIG_SCAN_SCHED_LOG_LEVEL);
+
+#define SCAN_INTERVAL 0x0200
+#define FLOOR_WINDOW MAX(SCAN_INTERVAL * CONFIG_SCAN_SCHED_FLOOR_PERCENT / 100, 0x0004)
+
+static void sched_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(sched_work, sched_handler);
+
+static bool is_started;
+static bool is_high;
+
+/**
+ * @brief (Re)start the scan with the given window
+ * 
+ * @param window in 0.625 ms units
+ * @return int 0 if successful, error code otherwise
+*/
+static int scan_restart(uint16_t window)
+{
+	struct bt_le_scan_param scan_param = {
+		.type       = BT_LE_SCAN_TYPE_PASSIVE,
+		.options    = BT_LE_SCAN_OPT_NONE,
+		.interval   = SCAN_INTERVAL,
+		.window     = window,
+	};
+
+	if (is_started) {
+		int err = bt_le_scan_stop();
+		if (err) {
+			return err;
+		}
+	}
+
+	int err = bt_le_scan_start(&scan_param, NULL);
+	is_started = (err == 0);
+
+	return err;
+}
+
+/**
+ * @brief Look at the expected arrival of one node
+ * 
+ * @param node
+ * @param now
+ * @param next_wake updated with the next time the schedule has to change
+ * @return bool true if the node is expected now
+*/
+static bool node_expected(const struct link_stats_node *node, int64_t now, int64_t *next_wake)
+{
+	int64_t period = (int64_t)node->period_ms;
+	int64_t since = now - node->last_new_ms;
+
+	if (period <= 0 || since > period * CONFIG_SCAN_SCHED_MISS_LIMIT) {
+		return false; /* Unknown or lost node, left to the discovery floor */
+	}
+
+	/* Report whose guarded window may contain now */
+	int64_t k = MAX((since + CONFIG_SCAN_SCHED_GUARD_MS) / period, 1);
+	int64_t start = node->last_new_ms + k * period;
+	int64_t end = start + CONFIG_SCAN_SCHED_BURST_MS + CONFIG_SCAN_SCHED_GUARD_MS;
+
+	if (now < start - CONFIG_SCAN_SCHED_GUARD_MS) {
+		*next_wake = MIN(*next_wake, start - CONFIG_SCAN_SCHED_GUARD_MS);
+		return false;
+	}
+
+	if (now < end) {
+		*next_wake = MIN(*next_wake, end);
+		return true;
+	}
+
+	*next_wake = MIN(*next_wake, start + period - CONFIG_SCAN_SCHED_GUARD_MS);
+	return false;
+}
+
+/**
+ * @brief Choose the scan window and the next time to look again
+ * 
+ * @param work
+*/
+static void sched_handler(struct k_work *work)
+{
+	struct link_stats_node node;
+	int64_t now = k_uptime_get();
+	int64_t next_wake = now + CONFIG_SCAN_SCHED_MAX_SLEEP_MS;
+	bool want_high = false;
+
+	for (size_t i = 0; i < CONFIG_LINK_STATS_MAX_NODES; i++) {
+		if (link_stats_get(i, &node) && node_expected(&node, now, &next_wake)) {
+			want_high = true;
+		}
+	}
+
+	if (want_high != is_high || !is_started) {
+		int err = scan_restart(want_high ? SCAN_INTERVAL : FLOOR_WINDOW);
+		if (err) {
+			LOG_ERR("Error %d: unable to restart the scan", err);
+		} else {
+			is_high = want_high;
+			LOG_DBG("Scan duty %s", is_high ? "high" : "floor");
+		}
+	}
+
+	k_work_reschedule(k_work_delayable_from_work(work), K_MSEC(MAX(next_wake - now, 1)));
+}
+
+/**
+ * @brief Start scanning at the discovery floor and run the scheduler
+ * 
+ * @return int 0 if successful, error code otherwise
+*/
+int scan_sched_start(void)
+{
+	int err = scan_restart(FLOOR_WINDOW);
+	if (err) {
+		return err;
+	}
+
+	k_work_reschedule(&sched_work, K_MSEC(CONFIG_SCAN_SCHED_MAX_SLEEP_MS));
+
+	return 0;
+}
+
+/**
+ * @brief Tell the scheduler a new counter was received so it can close the window early
+*/
+void scan_sched_notify(void)
+{
+	if (is_started) {
+		k_work_reschedule(&sched_work, K_NO_WAIT);
+	}
+}
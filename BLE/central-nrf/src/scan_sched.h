@@ -0,0 +1,17 @@
+/**
+ * scan_sched.h
+ * 
+ * Adaptive scan scheduler, the scan window follows the reporting period of the nodes
+ * 
+*/
+
+#ifndef SCAN_SCHED_H_
+#define SCAN_SCHED_H_
+
+#include <zephyr/kernel.h>
+
+int scan_sched_start(void);
+
+void scan_sched_notify(void);
+
+#endif /* SCAN_SCHED_H_ */
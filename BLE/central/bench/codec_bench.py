@@ -0,0 +1,73 @@
+"""
+Benchmark of the compressed block encoding
+
+Encodes a year of readings of one node (one reading every 10 minutes, with
+clock jitter) and prints the size per sample and the encode/decode speed.
+The values go through the decoder of the gateway, like the stored ones.
+
+Usage: python bench/codec_bench.py [--period 600] [--block-size 1024]
+"""
+import argparse
+import math
+import os
+import random
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'serreiot'))
+
+from codec import encode_block, decode_block
+from decoder import decode_payload
+from payload import SERVICE_UUID, FORMAT_VERSION, HEADER, PAIR
+
+# Slow daily variation of each metric (mean, amplitude)
+METRICS = {
+    'temperature': (22.0, 6.0),
+    'humidity': (55.0, 15.0),
+    'luminosite': (50.0, 50.0),
+    'gnd_temperature': (18.0, 3.0),
+    'gnd_humidity': (40.0, 10.0),
+    'batterie': (2.95, 0.02),
+}
+
+
+def received(value: float) -> float:
+    '''The value as the gateway stores it: sent in hundredths by the broadcaster, then decoded'''
+    whole, decimal = divmod(min(max(round(value * 100), 0), 25599), 100) # A pair is 0.00 to 255.99
+    return decode_payload(HEADER.pack(SERVICE_UUID, FORMAT_VERSION, 0) + PAIR.pack(1, whole, decimal))[1][1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compressed block encoding benchmark')
+    parser.add_argument('--period', type=float, default=600, help='Seconds between two readings')
+    parser.add_argument('--block-size', type=int, default=1024)
+    args = parser.parse_args()
+
+    random.seed(1)
+    count = int(365 * 86400 / args.period)
+    timestamps = [int(1_700_000_000_000 + i * args.period * 1000 + random.randint(-500, 500)) for i in range(count)]
+
+    total_bytes = 0
+    encode_time = decode_time = 0.0
+    for name, (mean, amplitude) in METRICS.items():
+        values = [received(mean + amplitude * math.sin(2 * math.pi * (ts / 86_400_000)) + random.uniform(-0.05, 0.05))
+                  for ts in timestamps]
+        size = 0
+        for i in range(0, count, args.block_size):
+            start = time.perf_counter()
+            block = encode_block(timestamps[i:i + args.block_size], values[i:i + args.block_size])
+            encode_time += time.perf_counter() - start
+            start = time.perf_counter()
+            decode_block(block)
+            decode_time += time.perf_counter() - start
+            size += len(block)
+        total_bytes += size
+        print(f'{name:>16}: {size / count:.2f} bytes/sample')
+
+    samples = count * len(METRICS)
+    print(f'{"all":>16}: {total_bytes / samples:.2f} bytes/sample, {total_bytes / 1024:.0f} KiB per node per year')
+    print(f'encode: {samples / encode_time:.0f} samples/s, decode: {samples / decode_time:.0f} samples/s')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,86 @@
+"""
+Microbenchmark of the packet decoding
+
+Compares the previous decoding (string split, Device per packet, Queue of the
+values) with the decoder (bytes, precompiled struct, cached Device).
+
+Usage: python bench/decoder_bench.py [--packets 200000] [--nodes 500]
+"""
+import argparse
+import os
+import sys
+import time
+from queue import Queue
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'serreiot'))
+
+from decoder import decode_line
+from device import Device
+from registry import Node
+from reader_bench import make_line
+
+
+def legacy_decode(line: str) -> dict:
+    '''Decoding done by Device and send_data before the decoder'''
+    line = line.strip("{}")
+    val = line.split(",")
+    data = val[2].split("-")
+    if data[0:2] != ['ab', 'cd']:
+        return None
+    data = [int(d, 16) for d in data[2:]]
+    if data[0] != 0:
+        return None
+
+    queue = Queue(0)
+    for d in data[2:]:
+        queue.put(d)
+
+    values = {}
+    while not queue.empty() and queue.qsize() >= 3:
+        val_id = queue.get()
+        whole_val = queue.get()
+        decimal_val = queue.get()
+        values[val_id] = whole_val + (decimal_val / 100)
+    return values
+
+
+def run_legacy(lines):
+    for raw in lines:
+        legacy_decode(raw.decode('utf-8').rstrip())
+
+
+def run_decoder(lines):
+    devices = {}
+    for raw in lines:
+        packet = decode_line(raw.rstrip())
+        device = devices.get(packet.addr)
+        if device is None:
+            devices[packet.addr] = Device(packet, Node(packet.addr.decode(), len(devices) + 1, '', ''))
+        else:
+            device.update(packet)
+
+
+def bench(name, func, lines):
+    start = time.perf_counter()
+    func(lines)
+    elapsed = time.perf_counter() - start
+    rate = len(lines) / elapsed
+    print(f'{name:>8}: {rate:>10.0f} packets/s')
+    return rate
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Packet decoding microbenchmark')
+    parser.add_argument('--packets', type=int, default=200000)
+    parser.add_argument('--nodes', type=int, default=500)
+    args = parser.parse_args()
+
+    lines = [make_line(i, args.nodes) for i in range(args.packets)]
+
+    before = bench('before', run_legacy, lines)
+    after = bench('after', run_decoder, lines)
+    print(f'speedup: {after / before:.1f}x')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,233 @@
+"""
+Load generator of the gateway, without hardware
+
+Writes data lines into pseudo-terminals that the gateway reads like dongles.
+The lines are replayed from a recording (at the original or an accelerated
+speed) or generated for a fleet of virtual nodes, with duplicated, corrupted
+and lost packets.
+
+Usage:
+    python bench/loadgen.py record <port> <file>        record a real dongle (one "<seconds> <line>" per line)
+    python bench/loadgen.py replay <file> [--speed 10]  replay a recording
+    python bench/loadgen.py synth [--nodes 500] [--period 10] [--dongles 2] [--dup 0.3] [--corrupt 0.01] [--loss 0.05] [--speed 10]
+
+replay and synth print the pseudo-terminals to give to the gateway.
+"""
+import argparse
+import heapq
+import os
+import random
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'serreiot'))
+
+from payload import METRICS, AGE_ID, encode_payload
+
+VALUE_IDS = tuple(METRICS) # Temperature, humidity, luminosity, ground temperature, ground humidity, battery
+
+
+def node_addr(node: int) -> str:
+    '''Address of a virtual node (like bt_addr_to_str)'''
+    return f'F0:CA:F0:CA:{(node >> 8) & 0xff:02X}:{node & 0xff:02X}'
+
+
+def data_line(name: str, addr: str, counter: int, values: dict, rssi: int = None) -> bytes:
+    '''Data line of the dongle ({name,addr,service_data[,rssi]})'''
+    line = f'{{{name},{addr},{encode_payload(counter, values).hex("-")}'
+    if rssi is not None:
+        line += f',{rssi}'
+    return (line + '}\n').encode()
+
+
+def corrupt(line: bytes, rng: random.Random) -> bytes:
+    '''Damage a line like a noisy or truncated serial transfer'''
+    kind = rng.randrange(3)
+    if kind == 0: # Cut
+        return line[:rng.randrange(1, len(line) - 1)] + b'\n'
+    if kind == 1: # Wrong character
+        i = rng.randrange(1, len(line) - 2)
+        return line[:i] + bytes([rng.randrange(0x21, 0x7f)]) + line[i + 1:]
+    return line[:-2] + b'-zz}\n' # Invalid hex
+
+
+class Fleet:
+    '''Virtual nodes that send a packet each period'''
+
+    def __init__(self, nodes, period, dongles=1, dup=0.0, corrupt=0.0, loss=0.0, seed=1):
+        self.nodes = nodes
+        self.period = period
+        self.dongles = dongles
+        self.dup = dup # Probability of an extra copy on a dongle (the advertising is repeated)
+        self.corrupt = corrupt # Probability of a damaged line
+        self.loss = loss # Probability a dongle misses a packet
+        self.rng = random.Random(seed)
+
+        self.sent = 0 # Packets sent by the nodes
+        self.heard = set() # Keys of the packets heard by at least one dongle, not damaged
+        self.lines = 0
+        self.duplicates = 0
+        self.corrupted = 0
+        self.lost = 0 # Packets heard by no dongle
+
+    def events(self, duration):
+        '''Yield (seconds, dongle, line, key) in time order, key is (addr, counter) or None for a damaged line'''
+        rng = self.rng
+        state = [{v: rng.uniform(10, 40) for v in VALUE_IDS} for _ in range(self.nodes)]
+        heap = [(rng.uniform(0, self.period), node, 0) for node in range(self.nodes)]
+        heapq.heapify(heap)
+
+        while heap and heap[0][0] < duration:
+            t, node, counter = heapq.heappop(heap)
+            heapq.heappush(heap, (t + self.period, node, counter + 1))
+
+            values = state[node]
+            for value_id in VALUE_IDS:
+                values[value_id] = min(99.0, max(0.0, values[value_id] + rng.uniform(-0.5, 0.5)))
+
+            addr = node_addr(node)
+            key = (addr, counter & 0xff)
+            self.sent += 1
+            heard = False
+            for dongle in range(self.dongles):
+                if rng.random() < self.loss:
+                    continue
+                copies = 1 + (rng.random() < self.dup)
+                self.duplicates += copies - 1
+                for copy in range(copies):
+                    age = rng.uniform(0.05, 0.3) + copy * 0.05 # Reading -> advertising, the age is refreshed
+                    line = data_line(f'LRIMa {node}', addr, counter, values | {AGE_ID: age}, rng.randint(-95, -40))
+                    self.lines += 1
+                    if rng.random() < self.corrupt:
+                        self.corrupted += 1
+                        yield t + copy * 0.05, dongle, corrupt(line, rng), None
+                        continue
+                    heard = True
+                    yield t + copy * 0.05 + rng.uniform(0, 0.01), dongle, line, key
+
+            if heard:
+                self.heard.add(key)
+            else:
+                self.lost += 1
+
+
+def recording(file):
+    '''Yield (seconds, 0, line, None) of a recording'''
+    with open(file, 'rb') as f:
+        for raw in f:
+            t, _, line = raw.partition(b' ')
+            yield float(t), 0, line.rstrip(b'\r\n') + b'\n', None
+
+
+class Emitter:
+    '''Write timed lines into pseudo-terminals (one per dongle)'''
+
+    def __init__(self, dongles, stamp=True):
+        self.ptys = [os.openpty() for _ in range(dongles)]
+        self.written = {} # Time each key was first written (the counters wrap, the copies are close)
+        self.stamp = stamp # Add the reception time to the data lines and send %time frames, like the dongle
+        self.boot = [time.monotonic() - random.uniform(0, 1000) for _ in self.ptys] # Start of the uptime of each dongle
+        self.time_sent = 0
+
+    @property
+    def ports(self):
+        return [os.ttyname(slave) for _, slave in self.ptys]
+
+    def run(self, events, speed=1.0):
+        '''Write the events at their time divided by speed, returns the number of lines'''
+        start = time.monotonic()
+        pending = [[] for _ in self.ptys]
+        due = start
+        count = 0
+
+        for t, dongle, line, key in events:
+            at = start + t / speed
+            if at > due: # Write everything due before waiting
+                self.__flush(pending)
+                delay = at - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+                due = max(at, time.monotonic())
+            now = time.monotonic()
+            if key is not None:
+                if now - self.written.get(key, 0) > 1.0:
+                    self.written[key] = now
+            if self.stamp and line.endswith(b'}\n'):
+                line = line[:-2] + b',%d}\n' % ((now - self.boot[dongle]) * 1000)
+            pending[dongle].append(line)
+            count += 1
+
+        self.__flush(pending)
+        return count
+
+    def __flush(self, pending):
+        now = time.monotonic()
+        if self.stamp and now - self.time_sent >= 1.0: # Once a second, like CONFIG_DATA_UART_TIME_PERIOD_SEC
+            self.time_sent = now
+            for boot, lines in zip(self.boot, pending):
+                lines.append(b'%%time,%d\n' % ((now - boot) * 1000))
+        for (master, _), lines in zip(self.ptys, pending):
+            view = memoryview(b''.join(lines))
+            while view:
+                written = os.write(master, view)
+                view = view[written:]
+            lines.clear()
+
+
+def record(port, file):
+    import serial
+    ser = serial.Serial(port, 115200, timeout=None)
+    start = time.monotonic()
+    with open(file, 'ab') as f:
+        while True:
+            line = ser.readline().rstrip(b'\r\n')
+            f.write(f'{time.monotonic() - start:.3f} '.encode() + line + b'\n')
+            f.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Gateway load generator')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    rec = sub.add_parser('record')
+    rec.add_argument('port')
+    rec.add_argument('file')
+
+    rep = sub.add_parser('replay')
+    rep.add_argument('file')
+    rep.add_argument('--speed', type=float, default=1.0)
+
+    syn = sub.add_parser('synth')
+    syn.add_argument('--nodes', type=int, default=500)
+    syn.add_argument('--period', type=float, default=10, help='Seconds between two packets of a node')
+    syn.add_argument('--duration', type=float, default=600, help='Simulated seconds')
+    syn.add_argument('--dongles', type=int, default=1)
+    syn.add_argument('--dup', type=float, default=0.0)
+    syn.add_argument('--corrupt', type=float, default=0.0)
+    syn.add_argument('--loss', type=float, default=0.0)
+    syn.add_argument('--speed', type=float, default=1.0)
+    args = parser.parse_args()
+
+    if args.command == 'record':
+        record(args.port, args.file)
+        return
+
+    if args.command == 'replay':
+        emitter = Emitter(1, stamp=False) # The recording has the fields and the frames of the dongle
+        events = recording(args.file)
+    else:
+        fleet = Fleet(args.nodes, args.period, args.dongles, args.dup, args.corrupt, args.loss)
+        emitter = Emitter(args.dongles)
+        events = fleet.events(args.duration)
+
+    print('ports:', ' '.join(emitter.ports))
+    input('Start the gateway on these ports, then press Enter')
+    lines = emitter.run(events, args.speed)
+    print(f'{lines} lines written')
+    if args.command == 'synth':
+        print(f'packets: {fleet.sent} sent, {fleet.lost} lost, {fleet.duplicates} duplicates, {fleet.corrupted} corrupted')
+    time.sleep(1) # Let the gateway read the end
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,178 @@
+"""
+Stand-in of a local MQTT broker (like Mosquitto), to try the MQTT sink without one
+
+MQTT 3.1.1 over TCP, only what the gateway and a test subscriber use: CONNECT,
+PUBLISH (QoS 0 and 1, retained messages), SUBSCRIBE with + and # wildcards,
+UNSUBSCRIBE, PINGREQ and DISCONNECT. It can be slowed down to see that a slow
+broker does not stall the gateway.
+
+Usage: python bench/mqtt_broker.py [--port 1883] [--delay 0.0] [--verbose]
+       mosquitto_sub -p 1883 -t 'serreiot/#' -v    (or any MQTT client)
+"""
+import argparse
+import socket
+import struct
+import threading
+import time
+
+
+def topic_matches(pattern: str, topic: str) -> bool:
+    '''Check a topic against a filter with + (one level) and # (every level left)'''
+    levels = topic.split('/')
+    for i, part in enumerate(pattern.split('/')):
+        if part == '#':
+            return True
+        if i >= len(levels) or (part != '+' and part != levels[i]):
+            return False
+    return len(pattern.split('/')) == len(levels)
+
+
+def packet(header: int, body: bytes) -> bytes:
+    length = len(body)
+    encoded = bytearray()
+    while True:
+        byte = length % 128
+        length //= 128
+        encoded.append(byte | 0x80 if length else byte)
+        if not length:
+            break
+    return bytes([header]) + bytes(encoded) + body
+
+
+def string(value: bytes) -> bytes:
+    return struct.pack('!H', len(value)) + value
+
+
+class Broker:
+    '''MQTT broker in a thread, one thread per client'''
+
+    def __init__(self, host='127.0.0.1', port=1883, delay=0.0, verbose=False):
+        self.delay = delay # Seconds waited before each PUBLISH is handled
+        self.verbose = verbose
+        self.published = 0 # PUBLISH received
+        self.retained = {} # Last retained payload of each topic
+        self.subscriptions = {} # {client socket: set of filters}
+        self.lock = threading.Lock()
+
+        self.server = socket.create_server((host, port))
+        self.port = self.server.getsockname()[1]
+        threading.Thread(target=self.__accept, daemon=True).start()
+
+    def __accept(self):
+        while True:
+            client, _ = self.server.accept()
+            threading.Thread(target=self.__client, args=(client,), daemon=True).start()
+
+    @staticmethod
+    def __read(client, size):
+        data = b''
+        while len(data) < size:
+            chunk = client.recv(size - len(data))
+            if not chunk:
+                raise ConnectionError('closed')
+            data += chunk
+        return data
+
+    def __packets(self, client):
+        '''Yield (type, flags, body) of each packet of a client'''
+        while True:
+            header = self.__read(client, 1)[0]
+            length, shift = 0, 0
+            while True:
+                byte = self.__read(client, 1)[0]
+                length += (byte & 0x7f) << shift
+                shift += 7
+                if not byte & 0x80:
+                    break
+            yield header >> 4, header & 0x0f, self.__read(client, length)
+
+    def __send(self, client, data):
+        try:
+            client.sendall(data)
+        except OSError:
+            pass
+
+    def __client(self, client):
+        try:
+            for kind, flags, body in self.__packets(client):
+                if kind == 1: # CONNECT
+                    self.__send(client, packet(0x20, b'\x00\x00'))
+                elif kind == 3: # PUBLISH
+                    self.__publish(client, flags, body)
+                elif kind == 8: # SUBSCRIBE
+                    self.__subscribe(client, body)
+                elif kind == 10: # UNSUBSCRIBE
+                    pos, filters = 2, set()
+                    while pos < len(body):
+                        size = struct.unpack_from('!H', body, pos)[0]
+                        filters.add(body[pos + 2:pos + 2 + size].decode())
+                        pos += 2 + size
+                    with self.lock:
+                        self.subscriptions.get(client, set()).difference_update(filters)
+                    self.__send(client, packet(0xb0, body[:2]))
+                elif kind == 12: # PINGREQ
+                    self.__send(client, packet(0xd0, b''))
+                elif kind == 14: # DISCONNECT
+                    break
+        except (ConnectionError, OSError):
+            pass
+        with self.lock:
+            self.subscriptions.pop(client, None)
+        client.close()
+
+    def __publish(self, client, flags, body):
+        if self.delay:
+            time.sleep(self.delay)
+        size = struct.unpack_from('!H', body)[0]
+        topic = body[2:2 + size].decode()
+        pos = 2 + size
+        qos = (flags >> 1) & 3
+        if qos:
+            self.__send(client, packet(0x40, body[pos:pos + 2])) # PUBACK
+            pos += 2
+        payload = body[pos:]
+
+        with self.lock:
+            self.published += 1
+            if flags & 1:
+                self.retained[topic] = payload
+            receivers = [c for c, filters in self.subscriptions.items() if any(topic_matches(f, topic) for f in filters)]
+        if self.verbose:
+            print(f'{topic} {payload.decode("utf-8", "replace")}')
+
+        message = packet(0x30, string(topic.encode()) + payload)
+        for receiver in receivers:
+            self.__send(receiver, message)
+
+    def __subscribe(self, client, body):
+        pos, filters = 2, []
+        while pos < len(body):
+            size = struct.unpack_from('!H', body, pos)[0]
+            filters.append(body[pos + 2:pos + 2 + size].decode())
+            pos += 3 + size # Filter and requested QoS
+        with self.lock:
+            self.subscriptions.setdefault(client, set()).update(filters)
+            retained = [(t, p) for t, p in self.retained.items() if any(topic_matches(f, t) for f in filters)]
+        self.__send(client, packet(0x90, body[:2] + bytes(len(filters)))) # SUBACK, QoS 0 granted
+
+        for topic, payload in retained:
+            self.__send(client, packet(0x31, string(topic.encode()) + payload))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Stand-in MQTT broker')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=1883)
+    parser.add_argument('--delay', type=float, default=0.0, help='Seconds waited before each PUBLISH is handled')
+    parser.add_argument('--verbose', action='store_true', help='Print every message')
+    args = parser.parse_args()
+
+    broker = Broker(args.host, args.port, args.delay, args.verbose)
+    print(f'MQTT broker on {args.host}:{broker.port}')
+    while True:
+        time.sleep(10)
+        print(f'{broker.published} messages, {len(broker.retained)} retained topics')
+
+
+if __name__ == '__main__':
+    main()
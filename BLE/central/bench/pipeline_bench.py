@@ -0,0 +1,204 @@
+"""
+Benchmark of the whole gateway pipeline, without hardware
+
+A synthetic fleet (see loadgen.py) is written into pseudo-terminals read by
+the Reader, the devices go through the same stages as in main.py (store,
+rollups, uplink batcher, outbox) up to a stub backend (see stub_backend.py).
+It prints the throughput, the latency percentiles (line written -> send_data,
+and line written -> accepted by the backend) and the drops of each stage.
+
+Usage: python bench/pipeline_bench.py [--nodes 1000] [--period 10] [--duration 120] [--speed 20]
+       [--dongles 2] [--dup 0.3] [--corrupt 0.01] [--loss 0.05] [--backend-latency 0.05] [--window 0.5] [--metrics] [--api]
+       [--mqtt] [--mqtt-delay 0.0] [--csv]
+"""
+import argparse
+import contextlib
+import http.client
+import io
+import os
+import sys
+import tempfile
+import threading
+import time
+import urllib.request
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'serreiot'))
+
+from loadgen import Fleet, Emitter
+from stub_backend import StubBackend
+from reader import Reader
+from registry import Registry
+from uplink import UplinkBatcher
+from outbox import Outbox
+from tsdb import TimeSeriesStore
+from rollup import Rollups
+from dedup import EARLIEST, BEST_RSSI
+from httpd import HttpServer
+from timing import AckTracer, wall_time
+from latest import LatestCache
+from local_api import LocalApi
+from sinks import Record, CallbackSink, MqttSink, CsvSink
+from mqtt_broker import Broker
+import metrics
+
+
+def percentiles(samples):
+    if not samples:
+        return 'no samples'
+    samples = sorted(samples)
+    pick = lambda p: samples[min(len(samples) - 1, int(p * len(samples)))] * 1000
+    return f'p50 {pick(0.5):.1f} ms, p90 {pick(0.9):.1f} ms, p99 {pick(0.99):.1f} ms, max {samples[-1] * 1000:.1f} ms'
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Gateway pipeline benchmark')
+    parser.add_argument('--nodes', type=int, default=1000)
+    parser.add_argument('--period', type=float, default=10, help='Seconds between two packets of a node')
+    parser.add_argument('--duration', type=float, default=120, help='Simulated seconds')
+    parser.add_argument('--speed', type=float, default=20, help='Simulated seconds per real second')
+    parser.add_argument('--dongles', type=int, default=2)
+    parser.add_argument('--dup', type=float, default=0.3)
+    parser.add_argument('--corrupt', type=float, default=0.01)
+    parser.add_argument('--loss', type=float, default=0.05)
+    parser.add_argument('--policy', choices=(EARLIEST, BEST_RSSI), default=EARLIEST)
+    parser.add_argument('--backend-latency', type=float, default=0.05, help='Seconds of each call to the backend')
+    parser.add_argument('--workers', type=int, default=4)
+    parser.add_argument('--window', type=float, default=0.5, help='Seconds of the uplink batches')
+    parser.add_argument('--metrics', action='store_true', help='Print the metrics endpoint at the end')
+    parser.add_argument('--api', action='store_true', help='Measure the reads of the local API at the end')
+    parser.add_argument('--mqtt', action='store_true', help='Also publish on a stand-in MQTT broker (see mqtt_broker.py)')
+    parser.add_argument('--mqtt-delay', type=float, default=0.0, help='Seconds the broker waits before each message')
+    parser.add_argument('--csv', action='store_true', help='Also write a rotating CSV file')
+    args = parser.parse_args()
+
+    folder = tempfile.mkdtemp()
+    logs = []
+    backend = StubBackend(latency=args.backend_latency)
+    fleet = Fleet(args.nodes, args.period, args.dongles, args.dup, args.corrupt, args.loss)
+    emitter = Emitter(args.dongles)
+
+    ingest_latency = []
+    e2e_latency = []
+    delivered = set()
+    path_addr = {} # Address of each document path
+    lock = threading.Lock()
+
+    tracer = AckTracer()
+
+    def update_doc(fields):
+        backend.update_doc(fields)
+        tracer.acked(fields)
+        now = time.monotonic()
+        with lock:
+            for path, value in fields.items():
+                if path.endswith('/id'):
+                    written = emitter.written.get((path_addr.get(path[:-3]), value))
+                    if written is not None:
+                        e2e_latency.append(now - written)
+
+    outbox = Outbox(os.path.join(folder, 'outbox'), update_doc, logs.append, workers=args.workers,
+                    dropped_cb=lambda paths: uplink.forget(paths))
+    uplink = UplinkBatcher(outbox.put, logs.append, args.window)
+    store = TimeSeriesStore(os.path.join(folder, 'serreiot.db'), logs.append)
+    rollups = Rollups(lambda addr, metric, resolution, window: store.append_rollup(addr, metric, resolution, window.start, window))
+    registry = Registry(os.path.join(folder, 'serreiot.db'), logs.append)
+    latest = LatestCache()
+
+    # Same sinks as main.py
+    def store_record(record):
+        values = record.values
+        if record.late: # Only the values not stored yet, a copy must not be counted twice in the windows
+            values = store.new_values(record.node.addr, record.time, values)
+            if not values:
+                return
+        missed = rollups.add(record.node.addr, record.time, values, record.late)
+        store.append(record.node.addr, record.time, values, record.late, missed)
+
+    def send_record(record):
+        if record.late:
+            return
+        path = record.node.path
+        tracer.sent(f'{path}/id', record.counter, record.sampled_at)
+        uplink.update({f'{path}/{value_id}': value for value_id, value in record.values.items()} | {f'{path}/id': record.counter})
+
+    sinks = [CallbackSink('store', store_record, logs.append, put_timeout=30.0), CallbackSink('backend', send_record, logs.append)]
+    if args.mqtt:
+        broker = Broker(port=0, delay=args.mqtt_delay)
+        sinks.append(MqttSink('127.0.0.1', broker.port, logs.append))
+    if args.csv:
+        sinks.append(CsvSink(os.path.join(folder, 'samples.csv'), logs.append, max_bytes=1_000_000))
+
+    def send_data(device):
+        record = Record(device.node, device.id, wall_time(device.sampled_at), device.values, device.sampled_at, device.late)
+        for sink in sinks:
+            sink.put(record)
+
+        written = emitter.written.get((device.addr, device.id))
+        with lock:
+            path_addr[device.path] = device.addr
+            delivered.add((device.addr, device.id))
+            if written is not None:
+                ingest_latency.append(time.monotonic() - written)
+
+    with contextlib.redirect_stdout(io.StringIO()):
+        reader = Reader(emitter.ports, 115200, registry, send_data, logs.append, dedup_policy=args.policy, cache=latest)
+        while sum(stats.connected for stats in reader.receiver_stats().values()) < args.dongles:
+            time.sleep(0.01)
+
+        start = time.perf_counter()
+        cpu_start = time.process_time()
+        lines = emitter.run(fleet.events(args.duration), args.speed)
+        emitted = time.perf_counter() - start
+
+        # Wait for the end of the pipeline
+        deadline = time.monotonic() + 60
+        while time.monotonic() < deadline and (reader.uplink_backlog or sinks[1].pending or outbox.pending_bytes or len(delivered & fleet.heard) < len(fleet.heard)):
+            time.sleep(0.05)
+        uplink.flush()
+        time.sleep(args.window + 0.5)
+        while time.monotonic() < deadline and outbox.pending_bytes:
+            time.sleep(0.05)
+        elapsed = time.perf_counter() - start
+        cpu = time.process_time() - cpu_start
+
+    receivers = reader.receiver_stats().values()
+    print(f'fleet:         {args.nodes} nodes, {fleet.sent} packets, {lines} lines in {emitted:.1f} s ({lines / emitted:.0f} lines/s)')
+    print(f'injected:      {fleet.duplicates} duplicates, {fleet.corrupted} corrupted, {fleet.lost} lost')
+    print(f'reader:        {sum(s.packets for s in receivers)} valid, {sum(s.errors for s in receivers)} errors, '
+          f'{sum(s.duplicates for s in receivers)} duplicates dropped, {reader.stalls} stalls')
+    good = len(delivered & fleet.heard)
+    print(f'delivered:     {good} / {len(fleet.heard)} packets heard ({len(fleet.heard) - good} dropped), '
+          f'{len(delivered - fleet.heard)} spurious (damaged lines that still decode)')
+    print(f'throughput:    {good / emitted:.0f} packets/s, CPU {cpu / elapsed * 100:.0f} %')
+    print(f'ingest:        {percentiles(ingest_latency)}')
+    print(f'end to end:    {percentiles(e2e_latency)}')
+    print(f'backend:       {backend.calls} calls, outbox {outbox.sent} sent, {outbox.dropped} dropped, {outbox.stalls} stalls')
+    for sink in sinks:
+        print(f'sink {sink.name + ":":9} {sink.written} written, {sink.pending} pending, {sink.dropped} dropped, {sink.errors} errors')
+    if args.mqtt:
+        print(f'broker:        {broker.published} messages, {len(broker.retained)} retained topics')
+
+    server = HttpServer('127.0.0.1', 0, logs.append)
+    server.route('/metrics', lambda path, query, headers: (200, {'Content-Type': 'text/plain'}, metrics.render().encode()))
+    LocalApi(server, latest)
+    if args.api:
+        connection = http.client.HTTPConnection('127.0.0.1', server.port)
+        for name, path in (('one node', '/api/nodes/1'), ('all nodes', '/api/nodes')):
+            for revalidate in (False, True):
+                etag, samples, size = None, [], 0
+                for _ in range(500):
+                    start = time.perf_counter()
+                    connection.request('GET', path, headers={'If-None-Match': etag} if revalidate and etag else {})
+                    response = connection.getresponse()
+                    size = len(response.read())
+                    samples.append(time.perf_counter() - start)
+                    etag = response.getheader('ETag')
+                print(f'api {name + (" 304" if revalidate else ""):14} {percentiles(samples)} ({size} bytes)')
+    if args.metrics:
+        with urllib.request.urlopen(f'http://127.0.0.1:{server.port}/metrics') as response:
+            print(response.read().decode())
+    os._exit(0) # The parser thread never ends
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,77 @@
+"""
+Throughput benchmark of the serial reader
+
+A pseudo-terminal stands in for the dongle: the benchmark writes data lines on
+one side and the Reader reads them on the other side, like a real port.
+It prints the number of packets per second handed to send_data and the CPU
+used by the process while the port is idle.
+
+Usage: python bench/reader_bench.py [--packets 20000] [--nodes 500]
+"""
+import argparse
+import contextlib
+import io
+import os
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'serreiot'))
+
+from reader import Reader
+from registry import Registry
+
+
+def make_line(i: int, nodes: int) -> bytes:
+    '''Data line of the i-th packet, each node gets an increasing counter'''
+    node = i % nodes
+    counter = (i // nodes) % 256
+    return (f'{{LRIMa test {node % 10},f0:ca:f0:ca:{node >> 8:02x}:{node & 0xff:02x},'
+            f'ab-cd-00-{counter:02x}-01-14-00-02-30-00-03-32-00-04-12-00-05-28-00-fe-02-5a-fd-00-2d,-60,{i * 10}}}\n').encode()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Serial reader throughput benchmark')
+    parser.add_argument('--packets', type=int, default=20000)
+    parser.add_argument('--nodes', type=int, default=500)
+    parser.add_argument('--idle', type=float, default=2.0, help='Seconds used to measure the idle CPU')
+    args = parser.parse_args()
+
+    master, slave = os.openpty()
+    received = 0
+    done = threading.Event()
+
+    def send_data(device):
+        nonlocal received
+        received += 1
+        if received == args.packets:
+            done.set()
+
+    with contextlib.redirect_stdout(io.StringIO()) as out:
+        registry = Registry(os.path.join(tempfile.mkdtemp(), 'nodes.db'), lambda msg: None)
+        Reader(os.ttyname(slave), 115200, registry, send_data, lambda msg: None)
+
+        # Idle CPU, nothing is written on the port
+        cpu_start = time.process_time()
+        time.sleep(args.idle)
+        idle_cpu = (time.process_time() - cpu_start) / args.idle
+
+        payload = b''.join(make_line(i, args.nodes) for i in range(args.packets))
+        start = time.perf_counter()
+        view = memoryview(payload)
+        while view:
+            written = os.write(master, view[:4096])
+            view = view[written:]
+            out.truncate(0) # Keep the memory flat if something is printed
+        done.wait(timeout=120)
+        elapsed = time.perf_counter() - start
+
+    print(f'packets:       {received}/{args.packets}')
+    print(f'throughput:    {received / elapsed:.0f} packets/s')
+    print(f'idle CPU:      {idle_cpu * 100:.1f} %')
+    os._exit(0) # The parser thread never ends
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,90 @@
+"""
+Local stand-in of the backend, to test the outbox during outages
+
+The backend can be paused (every send fails like a dropped connection) and
+resumed. Run as a script, it simulates an outage: updates are queued while the
+backend is paused, then replayed in order once it's resumed.
+
+Usage: python bench/stub_backend.py [--updates 5000] [--outage 5] [--max-bytes 200000] [--latency 0.005] [--workers 4]
+"""
+import argparse
+import os
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'serreiot'))
+
+from outbox import Outbox
+
+
+class StubBackend:
+    '''Keeps the last value of each path, like the document of the backend'''
+
+    def __init__(self, latency=0.0):
+        self.doc = {}
+        self.calls = 0
+        self.failures = 0
+        self.latency = latency
+        self.__online = threading.Event()
+        self.__online.set()
+        self.__lock = threading.Lock()
+
+    def pause(self):
+        self.__online.clear()
+
+    def resume(self):
+        self.__online.set()
+
+    def update_doc(self, fields):
+        time.sleep(self.latency)
+        with self.__lock:
+            if not self.__online.is_set():
+                self.failures += 1
+                raise ConnectionError('backend paused')
+            self.calls += 1
+            self.doc.update(fields)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Outbox outage simulation')
+    parser.add_argument('--updates', type=int, default=5000)
+    parser.add_argument('--outage', type=float, default=5, help='Seconds the backend is paused')
+    parser.add_argument('--max-bytes', type=int, default=200_000, help='Bound of the outbox')
+    parser.add_argument('--latency', type=float, default=0.005, help='Seconds of each call to the backend')
+    parser.add_argument('--workers', type=int, default=4, help='Requests in flight at once')
+    parser.add_argument('--live', action='store_true', help='Keep the backend online (measures how far the uplink lags)')
+    args = parser.parse_args()
+
+    backend = StubBackend(latency=args.latency)
+    logs = []
+    folder = tempfile.mkdtemp()
+    outbox = Outbox(folder, backend.update_doc, logs.append, max_bytes=args.max_bytes,
+                    segment_bytes=args.max_bytes // 10, backoff_min=0.1, backoff_max=1.0,
+                    workers=args.workers)
+
+    if not args.live:
+        backend.pause()
+    start = time.perf_counter()
+    expected = {}
+    for i in range(args.updates):
+        update = {f'/doc/{i % 50}/temperature': 20 + i % 7, f'/doc/{i % 50}/id': i, '/doc/seq': i}
+        outbox.put(update)
+        expected.update(update)
+        time.sleep(args.outage / args.updates)
+    print(f'{"feed" if args.live else "outage"}: {outbox.pending_bytes} bytes pending, {outbox.dropped} dropped, {backend.failures} failed sends')
+
+    backend.resume()
+    while outbox.pending_bytes > 0:
+        time.sleep(0.05)
+    elapsed = time.perf_counter() - start - args.outage
+
+    print(f'replay: {outbox.sent} updates sent in {backend.calls} calls, {elapsed:.2f} s after the feed')
+    print(f'accounting: sent + dropped = {outbox.sent + outbox.dropped} / {args.updates}')
+    wrong = sum(1 for path, value in expected.items() if backend.doc.get(path) != value)
+    print(f'last values: {len(expected) - wrong} / {len(expected)} paths up to date')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,94 @@
+"""
+Benchmark of the local time-series store
+
+Inserts days of readings for many nodes (in batches, like the reader does),
+compacting every simulated hour like the writer thread, then prints the size
+of the database on disk per sample and queries the last 24 h of single nodes.
+
+Usage: python bench/tsdb_bench.py [--nodes 20] [--period 600] [--days 3]
+"""
+import argparse
+import math
+import os
+import random
+import sqlite3
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'serreiot'))
+
+from tsdb import TimeSeriesStore
+
+# Slow daily variation of each metric (mean, amplitude)
+METRICS = {1: (22.0, 6.0), 2: (55.0, 15.0), 3: (50.0, 50.0), 4: (18.0, 3.0), 5: (40.0, 10.0), 254: (2.95, 0.02)}
+
+
+def reading(ts: float) -> dict:
+    '''Values of a reading, in hundredths like the decoder gives them'''
+    phase = 2 * math.pi * (ts % 86400) / 86400
+    return {metric: round(mean + amplitude * math.sin(phase) + random.gauss(0, amplitude / 50), 2)
+            for metric, (mean, amplitude) in METRICS.items()}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Time-series store benchmark')
+    parser.add_argument('--nodes', type=int, default=20)
+    parser.add_argument('--period', type=float, default=600, help='Seconds between two readings of a node')
+    parser.add_argument('--days', type=int, default=3)
+    parser.add_argument('--block-size', type=int, default=1024)
+    parser.add_argument('--queries', type=int, default=100)
+    args = parser.parse_args()
+
+    random.seed(1)
+    now = time.time()
+    start_ts = now - args.days * 86400
+    readings = int(args.days * 86400 / args.period)
+    per_hour = max(1, int(3600 / args.period))
+
+    with tempfile.TemporaryDirectory() as folder:
+        path = os.path.join(folder, 'bench.db')
+        # Everything inserted is past the cutoff, each maintain() compacts the last simulated hour
+        store = TimeSeriesStore(path, print, flush_interval=0.01, compact_after_hours=0, block_size=args.block_size)
+
+        start = time.perf_counter()
+        for r in range(readings):
+            ts = start_ts + r * args.period
+            for node in range(args.nodes):
+                store.append(f'F0:CA:F0:CA:{node >> 8:02X}:{node & 0xff:02X}', ts, reading(ts))
+            if r % per_hour == per_hour - 1:
+                store.maintain()
+                store.join()
+        store.maintain()
+        store.join() # Wait for the writer
+        elapsed = time.perf_counter() - start
+        packets = readings * args.nodes
+        samples = packets * len(METRICS)
+        print(f'insert: {packets} packets ({samples} samples) in {elapsed:.1f} s, {packets / elapsed:.0f} packets/s')
+
+        db = sqlite3.connect(path)
+        db.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+        blocks, block_samples, data = db.execute("SELECT count(*), sum(count), sum(length(data)) FROM blocks").fetchone()
+        page_count, = db.execute("PRAGMA page_count").fetchone()
+        page_size, = db.execute("PRAGMA page_size").fetchone()
+        free, = db.execute("PRAGMA freelist_count").fetchone()
+        db.close()
+        print(f'blocks: {blocks}, {block_samples / blocks:.1f} samples and {data / blocks:.1f} B each, '
+              f'{data / block_samples:.2f} B/sample of encoded data')
+        print(f'on disk: {page_count * page_size / 1024:.0f} KiB ({free * page_size / 1024:.0f} KiB free), '
+              f'{page_count * page_size / samples:.2f} B/sample, '
+              f'{(page_count - free) * page_size / samples:.2f} B/sample without the free pages')
+
+        durations = []
+        for q in range(args.queries):
+            node = q % args.nodes
+            start = time.perf_counter()
+            rows = store.last(f'F0:CA:F0:CA:{node >> 8:02X}:{node & 0xff:02X}', 1, 86400)
+            durations.append(time.perf_counter() - start)
+        durations.sort()
+        print(f'last 24 h of one node: {len(rows)} samples, median {durations[len(durations) // 2] * 1000:.2f} ms, '
+              f'max {durations[-1] * 1000:.2f} ms')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,223 @@
+"""
+Compressed encoding of a block of samples of one metric (Gorilla style)
+
+Timestamps (milliseconds) are stored as delta of delta: readings come on a
+regular grid so most of them take a few bits. Values are stored either as the
+delta of the value scaled by 100 (the broadcaster sends hundredths), or as the
+XOR of the float64 with the previous one when a value doesn't fit hundredths.
+"""
+import math
+from struct import Struct
+
+MODE_DELTA = 0 # Values are hundredths, delta encoded
+MODE_XOR = 1 # Values are float64, XOR encoded
+
+SCALE = 100
+DELTA_LIMIT = 2**53 / SCALE # Larger values are XOR encoded, their hundredths would not fit the integers written
+
+HEADER = Struct("<BIqd") # Mode, count, first timestamp, first value
+FLOAT = Struct("<d")
+U64 = Struct("<Q")
+
+# Variable length integers: (prefix, prefix length, value bits)
+BUCKETS = ((0b10, 2, 7), (0b110, 3, 9), (0b1110, 4, 12), (0b11110, 5, 32))
+LAST_BUCKET = (0b11111, 5, 64)
+
+
+class BitWriter():
+
+    def __init__(self) -> None:
+        self.__out = bytearray()
+        self.__acc = 0 # Bits not written yet
+        self.__bits = 0
+
+    def write(self, value: int, bits: int) -> None:
+        '''Write the lowest bits of value'''
+        self.__acc = (self.__acc << bits) | (value & ((1 << bits) - 1))
+        self.__bits += bits
+        while self.__bits >= 8:
+            self.__bits -= 8
+            self.__out.append((self.__acc >> self.__bits) & 0xff)
+        self.__acc &= (1 << self.__bits) - 1
+
+    def to_bytes(self) -> bytes:
+        '''Get the bytes written, the last byte is padded with 0'''
+        out = bytes(self.__out)
+        if self.__bits:
+            out += bytes([(self.__acc << (8 - self.__bits)) & 0xff])
+        return out
+
+
+class BitReader():
+
+    def __init__(self, data: bytes, offset: int = 0) -> None:
+        self.__value = int.from_bytes(data[offset:], "big")
+        self.__left = (len(data) - offset) * 8 # Bits not read yet
+
+    def read(self, bits: int) -> int:
+        '''Read bits as an unsigned int'''
+        if bits > self.__left:
+            raise ValueError("The block is truncated")
+        self.__left -= bits
+        return (self.__value >> self.__left) & ((1 << bits) - 1)
+
+    def read_bit(self) -> int:
+        return self.read(1)
+
+
+def zigzag(value: int) -> int:
+    return (value << 1) ^ (value >> 63)
+
+
+def unzigzag(value: int) -> int:
+    return (value >> 1) ^ -(value & 1)
+
+
+def write_int(writer: BitWriter, value: int) -> None:
+    '''Write a signed int, 0 takes one bit and small values a few bits'''
+    if value == 0:
+        writer.write(0, 1)
+        return
+
+    encoded = zigzag(value)
+    for prefix, prefix_bits, bits in BUCKETS:
+        if encoded < (1 << bits):
+            writer.write(prefix, prefix_bits)
+            writer.write(encoded, bits)
+            return
+
+    prefix, prefix_bits, bits = LAST_BUCKET
+    writer.write(prefix, prefix_bits)
+    writer.write(encoded, bits)
+
+
+def read_int(reader: BitReader) -> int:
+    '''Read a signed int written by write_int'''
+    if reader.read_bit() == 0:
+        return 0
+
+    for _, _, bits in BUCKETS: # Each 1 moves to the next bucket
+        if reader.read_bit() == 0:
+            return unzigzag(reader.read(bits))
+
+    return unzigzag(reader.read(LAST_BUCKET[2]))
+
+
+def write_xor(writer: BitWriter, previous: int, current: int, window: list) -> None:
+    '''Write a float64 (as bits) XOR the previous one, window is [leading zeros, meaningful bits]'''
+    xor = previous ^ current
+    if xor == 0:
+        writer.write(0, 1)
+        return
+
+    writer.write(1, 1)
+    leading = min(64 - xor.bit_length(), 31)
+    trailing = (xor & -xor).bit_length() - 1
+
+    # Reuse the previous window when the meaningful bits fit in it
+    if window[1] and leading >= window[0] and trailing >= 64 - window[0] - window[1]:
+        writer.write(0, 1)
+        writer.write(xor >> (64 - window[0] - window[1]), window[1])
+        return
+
+    meaningful = 64 - leading - trailing
+    writer.write(1, 1)
+    writer.write(leading, 5)
+    writer.write(meaningful - 1, 6)
+    writer.write(xor >> trailing, meaningful)
+    window[0], window[1] = leading, meaningful
+
+
+def read_xor(reader: BitReader, previous: int, window: list) -> int:
+    '''Read a float64 (as bits) written by write_xor'''
+    if reader.read_bit() == 0:
+        return previous
+
+    if reader.read_bit() == 1:
+        window[0] = reader.read(5)
+        window[1] = reader.read(6) + 1
+
+    trailing = 64 - window[0] - window[1]
+    return previous ^ (reader.read(window[1]) << trailing)
+
+
+def encode_block(timestamps: list, values: list) -> bytes:
+    """
+    Encode a block of samples
+
+    Args:
+        timestamps (list): Timestamps in milliseconds, in increasing order
+        values (list): The values (float)
+
+    Returns:
+        bytes: The encoded block
+    """
+    count = len(timestamps)
+    if count == 0 or count != len(values):
+        raise ValueError("A block needs as many timestamps as values (at least one)")
+
+    mode = MODE_XOR
+    if all(math.isfinite(v) and abs(v) < DELTA_LIMIT for v in values):
+        scaled = [round(v * SCALE) for v in values]
+        if all(s / SCALE == v for s, v in zip(scaled, values)):
+            mode = MODE_DELTA
+
+    writer = BitWriter()
+
+    # Timestamps: delta then delta of delta
+    previous_delta = 0
+    for i in range(1, count):
+        delta = timestamps[i] - timestamps[i - 1]
+        write_int(writer, delta - previous_delta)
+        previous_delta = delta
+
+    # Values
+    if mode == MODE_DELTA:
+        for i in range(1, count):
+            write_int(writer, scaled[i] - scaled[i - 1])
+    else:
+        window = [0, 0]
+        previous = U64.unpack(FLOAT.pack(values[0]))[0]
+        for value in values[1:]:
+            current = U64.unpack(FLOAT.pack(value))[0]
+            write_xor(writer, previous, current, window)
+            previous = current
+
+    return HEADER.pack(mode, count, timestamps[0], values[0]) + writer.to_bytes()
+
+
+def decode_block(data: bytes) -> tuple:
+    """
+    Decode a block of samples
+
+    Args:
+        data (bytes): A block made by encode_block
+
+    Returns:
+        tuple: (timestamps, values)
+    """
+    mode, count, first_ts, first_value = HEADER.unpack_from(data)
+    reader = BitReader(data, HEADER.size)
+
+    timestamps = [first_ts]
+    delta = 0
+    for _ in range(1, count):
+        delta += read_int(reader)
+        timestamps.append(timestamps[-1] + delta)
+
+    values = [first_value]
+    if mode == MODE_DELTA:
+        scaled = round(first_value * SCALE)
+        for _ in range(1, count):
+            scaled += read_int(reader)
+            values.append(scaled / SCALE)
+    elif mode == MODE_XOR:
+        window = [0, 0]
+        previous = U64.unpack(FLOAT.pack(first_value))[0]
+        for _ in range(1, count):
+            previous = read_xor(reader, previous, window)
+            values.append(FLOAT.unpack(U64.pack(previous))[0])
+    else:
+        raise ValueError(f"Unknown block mode {mode}")
+
+    return timestamps, values
@@ -0,0 +1,93 @@
+from payload import SERVICE_UUID, FORMAT_VERSION, HEADER, PAIR, LAYOUT, SCALES, DEFAULT_SCALE, AGE_ID, decode_layout
+
+
+class DecodeError(ValueError):
+    '''The line can't be decoded, the message tells why'''
+
+
+class Packet():
+    '''One decoded data line'''
+    __slots__ = ("name", "addr", "counter", "values", "rssi", "rx_ms", "age")
+
+    def __init__(self, name: bytes, addr: bytes, counter: int, values: dict, rssi: int = None, rx_ms: int = None,
+                 age: float = None) -> None:
+        self.name = name
+        self.addr = addr
+        self.counter = counter
+        self.values = values # {value id: value}
+        self.rssi = rssi # dBm, None with the dongles that don't send it
+        self.rx_ms = rx_ms # Uptime of the dongle at the reception, None with the dongles that don't send it
+        self.age = age # Seconds between the reading and the reception, None with the broadcasters that don't send it
+
+
+def decode_payload(data: bytes) -> tuple:
+    """
+    Decode the service data
+
+    Args:
+        data (bytes): The service data, UUID included
+
+    Returns:
+        tuple: (counter, {value id: value})
+    """
+    if len(data) == LAYOUT.size: # Fast path, the layout of the broadcaster (see payload.json)
+        uuid, version, counter, values = decode_layout(data)
+    else:
+        if len(data) < HEADER.size:
+            raise DecodeError("The service data is too short")
+        uuid, version, counter = HEADER.unpack_from(data)
+        end = HEADER.size + (len(data) - HEADER.size) // PAIR.size * PAIR.size
+        values = {}
+        for val_id, whole, decimal in PAIR.iter_unpack(data[HEADER.size:end]):
+            scale = SCALES.get(val_id, DEFAULT_SCALE)
+            values[val_id] = (whole * scale + decimal) / scale # Same float as the fast path
+
+    if uuid != SERVICE_UUID:
+        raise DecodeError("The service is not valid")
+
+    if version != FORMAT_VERSION:
+        raise DecodeError(f"The format version {version} is not supported")
+
+    return counter, values
+
+
+def decode_line(line: bytes) -> Packet:
+    """
+    Decode a data line of the dongle
+
+    Args:
+        line (bytes): The line without the line ending (format: {name,addr,service_data[,rssi[,rx_ms]]})
+
+    Returns:
+        Packet: The decoded line (raises DecodeError if the line is not valid)
+    """
+    if line[:1] != b"{" or line[-1:] != b"}": # Check if the data has the right format
+        raise DecodeError("The data is not in the right format")
+
+    if line.count(b"{") > 1 or line.count(b"}") > 1: # Check if there is more than one {} in the data
+        raise DecodeError("There is more than one {} in the data")
+
+    val = line[1:-1].split(b",")
+    if len(val) not in (3, 4, 5): # Check if there is the right amount of commas
+        raise DecodeError("There is not the right amount of commas")
+
+    name, addr, hex_data = val[:3]
+
+    rssi = rx_ms = None
+    if len(val) >= 4:
+        try:
+            rssi = int(val[3])
+            if len(val) == 5:
+                rx_ms = int(val[4])
+        except ValueError:
+            raise DecodeError("The RSSI or the reception time is not a number") from None
+
+    try:
+        data = bytes.fromhex(hex_data.replace(b"-", b"").decode("ascii"))
+    except (ValueError, UnicodeDecodeError):
+        raise DecodeError("The service data is not valid hex") from None
+
+    counter, values = decode_payload(data)
+    age = values.pop(AGE_ID, None)
+
+    return Packet(name, addr, counter, values, rssi, rx_ms, age)
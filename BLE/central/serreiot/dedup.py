@@ -0,0 +1,66 @@
+from collections import deque
+
+EARLIEST = "earliest" # The first copy is sent at once
+BEST_RSSI = "best_rssi" # The copies are gathered during the hold time, the best one is sent
+
+class Deduplicator():
+
+    def __init__(self, window=2.0, policy=EARLIEST, hold=0.1) -> None:
+        """
+        Keep one copy of each packet heard by several receivers
+
+        A packet is identified by its key (address, counter). The key is remembered
+        for window seconds after its first copy, the other copies received meanwhile
+        are dropped.
+
+        Args:
+            window (float): Seconds a key is remembered (longer than the delay between the receivers, shorter than a counter wrap)
+            policy (str): EARLIEST or BEST_RSSI
+            hold (float): Seconds the copies are gathered with BEST_RSSI
+        """
+        self.__window = max(window, hold)
+        self.__policy = policy
+        self.__hold = hold
+
+        self.__seen = {} # [best rssi, best item, sent] of each key
+        self.__order = deque() # (time, key) in arrival order, to forget the keys
+        self.__held = deque() # (deadline, entry) of the keys waiting for more copies, in order
+
+    def __len__(self) -> int:
+        return len(self.__seen)
+
+    def offer(self, key, rssi, item, now: float):
+        '''Give a copy, returns the item to send now (None if it's a duplicate or held)'''
+        while self.__order and self.__order[0][0] + self.__window <= now: # Forget the old keys
+            del self.__seen[self.__order.popleft()[1]]
+
+        entry = self.__seen.get(key)
+
+        if entry is None: # First copy
+            self.__order.append((now, key))
+            if self.__policy == EARLIEST:
+                self.__seen[key] = [rssi, None, True]
+                return item
+            entry = [rssi, item, False]
+            self.__seen[key] = entry
+            self.__held.append((now + self.__hold, entry))
+            return None
+
+        if not entry[2] and rssi is not None and (entry[0] is None or rssi > entry[0]): # Better copy
+            entry[0] = rssi
+            entry[1] = item
+        return None
+
+    def due(self, now: float) -> list:
+        '''Get the held items whose hold time is over'''
+        items = []
+        while self.__held and self.__held[0][0] <= now:
+            entry = self.__held.popleft()[1]
+            items.append(entry[1])
+            entry[1] = None
+            entry[2] = True
+        return items
+
+    def next_deadline(self) -> float:
+        '''Get the end of the next hold time, None if nothing is held'''
+        return self.__held[0][0] if self.__held else None
@@ -1,41 +1,76 @@
-from queue import Queue
-from abc import ABC
+from decoder import Packet
+from registry import Node
+from sequence import SequenceTracker
 
-class Device(ABC):
+class Device():
 
-    def __init__(self, line) -> None:
+    def __init__(self, packet: Packet, node: Node, sequence: SequenceTracker = None, sampled_at: float = None,
+                 late: bool = False) -> None:
         """
-        Create a new device from the data
-        
+        Create a new device from its first packet
+
         Args:
-            data (str): The data from the scan (format: {name,addr,service_data})
+            packet (Packet): The decoded data line
+            node (Node): The node of its address in the registry
+            sequence (SequenceTracker): The counters received, for the device kept by the reader
+            sampled_at (float): Host monotonic time of the reading
+            late (bool): Older than a sample already handed over, for the copy handed over by the reader
         """
-        line = line.strip("{}") # Remove the first and last char
-        val = line.split(",") # Split the string into a list
-
-        self.__name = val[0]
-        self.__addr = val[1]
-        self.__data = val[2].split("-") # Split the data into a list
+        self.__name = packet.name.decode("utf-8", "replace")
+        self.__addr = node.addr
+        self.__node = node
+        self.__sequence = sequence
+        self.__late = late
+        self.__held = None
         self.__id = -1
+        self.__values = {}
+
+        self.update(packet, sampled_at)
+
+    def update(self, packet: Packet, sampled_at: float = None) -> None:
+        '''Take the data of a new packet of this device'''
+        self.__id = packet.counter
+        self.__values = packet.values
+        self.__sampled_at = sampled_at
+
+    def hold(self, entry: tuple) -> None:
+        '''Keep a packet until its counter is known to be a reboot or a stray copy (HELD)'''
+        self.__held = entry
+
+    def release(self) -> tuple:
+        '''Take the packet held (None if none)'''
+        entry, self.__held = self.__held, None
+        return entry
+
+    @property
+    def node(self) -> Node:
+        '''Get the node of the registry'''
+        return self.__node
+
+    @property
+    def sequence(self) -> SequenceTracker:
+        '''Get the counters received (None for a copy)'''
+        return self.__sequence
 
-        self.__index = self.__name[-1] #Get last char of the name
-        
-        # Check if it's the right service
-        if self.__data[0:2] != ['ab', 'cd']:
-            return None
-        
-        self.__data = self.__data[2:] # Remove the service id
-        self.__data = [int(d, 16) for d in self.__data] # Convert the data from hex to int
-       
-        if self.__data[0] != 0: # Check if the first byte is 0
-            return None
-
-        self.__id = self.__data[1] # Set the id
-    
     @property
-    def index(self) -> str:
-        """Get the index of the sensor"""
-        return self.__index
+    def sampled_at(self) -> float:
+        '''Get the host monotonic time of the reading (None if unknown)'''
+        return self.__sampled_at
+
+    @property
+    def late(self) -> bool:
+        '''Check if the reading is older than one already handed over (missed counter, replay)'''
+        return self.__late
+
+    @property
+    def index(self) -> int:
+        """Get the stable id of the sensor"""
+        return self.__node.node_id
+
+    @property
+    def path(self) -> str:
+        '''Get the path of the document of the sensor'''
+        return self.__node.path
 
     @property
     def id(self) -> int:
@@ -53,27 +88,13 @@ class Device(ABC):
         return self.__name
 
     @property
-    def data(self) -> int:
-        '''Get the data'''
-        return self.__data
-
-    def getDataQueue(self) -> Queue:
-        """Get the queue with the data (the id is removed)"""
-        if len(self.__data) <= 2:
-            return Queue(0)
-        
-        queue = Queue(0)
-
-        # Loop for each ellement
-        for d in self.__data[2:]: # Remove the id
-            queue.put(d)
-
-        return queue
-
+    def values(self) -> dict:
+        '''Get the values of the last packet ({value id: value})'''
+        return self.__values
 
     def __eq__(self, __value: object) -> bool:
         """Compare if the two devices are identical"""
-        if not isinstance(object, Device):
+        if not isinstance(__value, Device):
             return False
 
-        return self.__addr == object.addr and self.__name == object.name
+        return self.__addr == __value.addr and self.__name == __value.name
@@ -0,0 +1,66 @@
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
+from urllib.parse import urlsplit, parse_qs
+from threading import Thread
+
+class HttpServer():
+
+    def __init__(self, host, port, send_logs_cb) -> None:
+        """
+        Small local HTTP server, each path is handled by a function (GET only)
+
+        A handler is called with (path, query, headers) and returns (status, headers, body).
+        A route ending with / also handles every path under it.
+
+        Args:
+            host (str): The address to listen on ("127.0.0.1" for this computer only)
+            port (int): The TCP port
+            send_logs_cb (function): Called with each log message
+        """
+        self.__routes = {}
+        self.__send_logs_cb = send_logs_cb
+        server = self
+
+        class Handler(BaseHTTPRequestHandler):
+            def do_GET(self):
+                server._handle(self)
+
+            def log_message(self, format, *args): # Not on the console
+                pass
+
+        self.__httpd = ThreadingHTTPServer((host, port), Handler)
+        self.__httpd.daemon_threads = True
+        self.__thread = Thread(target=self.__httpd.serve_forever, daemon=True)
+        self.__thread.start()
+
+    @property
+    def port(self) -> int:
+        return self.__httpd.server_address[1]
+
+    def route(self, path: str, handler) -> None:
+        '''Handle a path (or every path under it if it ends with /)'''
+        self.__routes[path] = handler
+
+    def _handle(self, request: BaseHTTPRequestHandler) -> None:
+        url = urlsplit(request.path)
+        handler = self.__routes.get(url.path)
+        if handler is None:
+            prefix = url.path
+            while handler is None and "/" in prefix.rstrip("/"):
+                prefix = prefix.rstrip("/").rsplit("/", 1)[0] + "/"
+                handler = self.__routes.get(prefix)
+
+        try:
+            if handler is None:
+                status, headers, body = 404, {"Content-Type": "text/plain"}, b"Not found\n"
+            else:
+                status, headers, body = handler(url.path, parse_qs(url.query), request.headers)
+        except Exception as e:
+            self.__send_logs_cb(f"[Error] HTTP {url.path}: {e}")
+            status, headers, body = 500, {"Content-Type": "text/plain"}, b"Internal error\n"
+
+        request.send_response(status)
+        for name, value in headers.items():
+            request.send_header(name, value)
+        request.send_header("Content-Length", str(len(body)))
+        request.end_headers()
+        request.wfile.write(body)
@@ -0,0 +1,111 @@
+from collections import deque
+from threading import Lock
+
+from payload import METRICS
+from timing import wall_time
+
+class NodeState():
+    '''Latest values of one node'''
+    __slots__ = ("node", "counter", "time", "values", "recent", "version")
+
+    def __init__(self, node, recent_size: int) -> None:
+        self.node = node
+        self.counter = None
+        self.time = None # Seconds since the epoch of the reading
+        self.values = {} # {metric name: value}
+        self.recent = deque(maxlen=recent_size) # (time, counter, values) of the last samples, oldest first
+        self.version = 0
+
+class LatestCache():
+
+    def __init__(self, recent_size=60) -> None:
+        """
+        Latest values of each node in memory, for the local API
+
+        Updated by the reader as soon as a packet is accepted, before the uplink.
+        Each change increments the version of the node and the global version,
+        they are the ETags of the local API.
+
+        Args:
+            recent_size (int): Number of samples kept for each node
+        """
+        self.__recent_size = recent_size
+        self.__nodes = {} # NodeState of each node id
+        self.__addrs = {} # Node id of each address
+        self.__version = 0
+        self.__lock = Lock()
+
+    def __len__(self) -> int:
+        return len(self.__nodes)
+
+    @property
+    def version(self) -> int:
+        '''Incremented at each update'''
+        return self.__version
+
+    def update(self, node, counter: int, values: dict, sampled_at: float = None) -> None:
+        """
+        Take the values of an accepted packet
+
+        Args:
+            node (Node): The node of the packet in the registry
+            counter (int): The counter of the packet
+            values (dict): {value id: value}
+            sampled_at (float): Host monotonic time of the reading (None for now)
+        """
+        now = wall_time(sampled_at)
+        named = {METRICS.get(value_id, str(value_id)): value for value_id, value in values.items()}
+
+        with self.__lock:
+            state = self.__nodes.get(node.node_id)
+            if state is None:
+                state = NodeState(node, self.__recent_size)
+                self.__nodes[node.node_id] = state
+                self.__addrs[node.addr] = node.node_id
+            state.node = node # The registry may have provisioned it again
+            state.counter = counter
+            state.time = now
+            state.values = named
+            state.recent.append((now, counter, named))
+            state.version += 1
+            self.__version += 1
+
+    def node_version(self, node_id: int) -> int:
+        '''Incremented at each update of a node (None if unknown)'''
+        state = self.__nodes.get(node_id)
+        return None if state is None else state.version
+
+    def find(self, key: str) -> int:
+        '''Get the node id of a node id or an address (None if unknown)'''
+        if key.isdigit():
+            return int(key) if int(key) in self.__nodes else None
+        return self.__addrs.get(key.upper())
+
+    def __describe(self, state: NodeState) -> dict:
+        node = state.node
+        return {
+            "node_id": node.node_id,
+            "addr": node.addr,
+            "name": node.name,
+            "path": node.path,
+            "counter": state.counter,
+            "time": round(state.time, 3),
+            "values": state.values,
+        }
+
+    def latest(self, node_id: int) -> tuple:
+        '''Get (version of the node, latest values of the node), None if unknown'''
+        with self.__lock:
+            state = self.__nodes.get(node_id)
+            return None if state is None else (state.version, self.__describe(state))
+
+    def latest_all(self) -> tuple:
+        '''Get (global version, latest values of every node by node id)'''
+        with self.__lock:
+            return self.__version, [self.__describe(self.__nodes[node_id]) for node_id in sorted(self.__nodes)]
+
+    def recent(self, node_id: int) -> tuple:
+        '''Get (version of the node, [(time, counter, values)] oldest first), None if unknown'''
+        with self.__lock:
+            state = self.__nodes.get(node_id)
+            return None if state is None else (state.version, list(state.recent))
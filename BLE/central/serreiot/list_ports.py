@@ -1,36 +1,44 @@
-import sys
-import glob
-import serial
+import re
+from serial.tools import list_ports
 
+DONGLE_VID = 0x1915 # CONFIG_USB_DEVICE_VID of the central
+DONGLE_PID = 0x520f # CONFIG_USB_DEVICE_PID of the central
+DATA_INTERFACE = 2 # USB interface of the data channel (cdc_acm_uart1, after the 2 interfaces of the console)
 
-def serial_ports():
-    """ Lists serial port names
 
-        :raises EnvironmentError:
-            On unsupported or unknown platforms
+def dongle_ports():
+    """ Lists the data ports of the connected dongles, from the USB descriptors
+
+        The ports are not opened, the list only comes from the system (sysfs on Linux,
+        the registry on Windows), so it takes a few milliseconds.
+
         :returns:
-            A list of the serial ports available on the system
+            A list of the serial port names of the data channels, sorted
     """
-    if sys.platform.startswith('win'):
-        ports = ['COM%s' % (i + 1) for i in range(256)]
-    elif sys.platform.startswith('linux') or sys.platform.startswith('cygwin'):
-        # this excludes your current terminal "/dev/tty"
-        ports = glob.glob('/dev/tty[A-Za-z]*')
-    elif sys.platform.startswith('darwin'):
-        ports = glob.glob('/dev/tty.*')
-    else:
-        raise EnvironmentError('Unsupported platform')
+    dongles = {} # Ports of each dongle
+    for port in list_ports.comports():
+        if port.vid != DONGLE_VID or port.pid != DONGLE_PID:
+            continue
+        key = port.serial_number or re.sub(r':.*', '', port.location or '') # Same for the ports of a dongle
+        dongles.setdefault(key, []).append(port)
 
     result = []
-    for port in ports:
-        try:
-            s = serial.Serial(port)
-            s.close()
-            result.append(port)
-        except (OSError, serial.SerialException):
-            pass
-    return result
+    for ports in dongles.values():
+        data = [p for p in ports if interface(p) == DATA_INTERFACE]
+        if not data and len(ports) == 2: # No interface numbers (macOS): the data port comes second
+            data = [sorted(ports, key=lambda p: p.device)[1]]
+        result.extend(p.device for p in data)
+    return sorted(result)
+
+
+def interface(port):
+    """ Gets the USB interface number of a port, None if it's unknown
+
+        The location ends with the interface ("1-1.4:1.2" on Linux, "1-4:x.2" on Windows).
+    """
+    match = re.search(r':[0-9x]+\.(\d+)$', port.location or '')
+    return int(match.group(1)) if match else None
 
 
 if __name__ == '__main__':
-    print(serial_ports())
\ No newline at end of file
+    print(dongle_ports())
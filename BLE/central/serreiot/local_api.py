@@ -0,0 +1,87 @@
+from time import time
+import json
+
+class LocalApi():
+
+    def __init__(self, http, cache) -> None:
+        """
+        JSON API of the latest values, for the controllers of the greenhouse
+
+        GET /api/nodes                latest values of every node
+        GET /api/nodes/<id>           latest values of a node (node id or address)
+        GET /api/nodes/<id>/recent    last samples of a node (?limit=n, ?metric=name)
+
+        Each response has an ETag, a request with the same If-None-Match gets
+        304 Not Modified without a body. The bodies are kept until the values change.
+
+        Args:
+            http (HttpServer): The local HTTP server
+            cache (LatestCache): The latest values
+        """
+        self.__cache = cache
+        self.__boot = f"{int(time()):x}" # The versions start again at each start
+        self.__bodies = {} # (version, body) of each path without query
+
+        http.route("/api/nodes", self.__nodes)
+        http.route("/api/nodes/", self.__node)
+
+    def __etag(self, version: int) -> str:
+        return f'"{self.__boot}-{version}"'
+
+    def __respond(self, key: str, version: int, headers, snapshot) -> tuple:
+        """
+        Response of a versioned resource
+
+        Args:
+            key (str): Key of the body kept until the version changes (None to not keep it)
+            version (int): The current version of the resource
+            headers: The headers of the request
+            snapshot (function): Returns (version, data), only called when the version changed
+        """
+        if headers.get("If-None-Match") == self.__etag(version):
+            return 304, {"ETag": self.__etag(version), "Cache-Control": "no-cache"}, b""
+
+        cached = self.__bodies.get(key)
+        if cached is None or cached[0] != version:
+            version, data = snapshot()
+            cached = (version, json.dumps(data, separators=(",", ":")).encode())
+            if key is not None:
+                self.__bodies[key] = cached
+
+        return 200, {"ETag": self.__etag(cached[0]), "Cache-Control": "no-cache", "Content-Type": "application/json"}, cached[1]
+
+    def __error(self, status: int, message: str) -> tuple:
+        return status, {"Content-Type": "application/json"}, json.dumps({"error": message}).encode()
+
+    def __nodes(self, path: str, query: dict, headers) -> tuple:
+        return self.__respond(path, self.__cache.version, headers, self.__cache.latest_all)
+
+    def __node(self, path: str, query: dict, headers) -> tuple:
+        parts = path[len("/api/nodes/"):].strip("/").split("/")
+        node_id = self.__cache.find(parts[0])
+        if node_id is None:
+            return self.__error(404, f"Unknown node {parts[0]}")
+        version = self.__cache.node_version(node_id)
+
+        if len(parts) == 1:
+            return self.__respond(f"/api/nodes/{node_id}", version, headers, lambda: self.__cache.latest(node_id))
+
+        if len(parts) == 2 and parts[1] == "recent":
+            metric = query.get("metric", [None])[0]
+            try:
+                limit = int(query.get("limit", [0])[0])
+            except ValueError:
+                return self.__error(400, "limit is not a number")
+
+            def snapshot():
+                version, samples = self.__cache.recent(node_id)
+                if limit > 0:
+                    samples = samples[-limit:]
+                if metric is None:
+                    return version, [{"time": round(t, 3), "counter": counter, "values": values} for t, counter, values in samples]
+                return version, [{"time": round(t, 3), "counter": counter, "value": values.get(metric)} for t, counter, values in samples]
+
+            # The body depends on the query, it is only kept without one
+            return self.__respond(None if query else f"/api/nodes/{node_id}/recent", version, headers, snapshot)
+
+        return self.__error(404, f"Unknown path {path}")
@@ -0,0 +1,159 @@
+from threading import Thread, Event, Lock
+from collections import deque
+from logging.handlers import RotatingFileHandler
+from time import monotonic, sleep
+import logging, time
+
+SEVERITIES = ("error", "warning", "info")
+
+# Messages per second and burst allowed for each severity
+DEFAULT_RATES = {
+    "error": (5.0, 50),
+    "warning": (2.0, 20),
+    "info": (1.0, 10),
+}
+
+class LogSink():
+
+    def __init__(self, send_cb, path="serreiot.log", capacity=1000, doc_size=100, flush_interval=5.0,
+                 max_bytes=1_000_000, backup_count=5, rates=DEFAULT_RATES, load_cb=None) -> None:
+        """
+        Keep the logs in memory and write them in the background, the caller never waits
+
+        The logs document keeps its shape, the list /doc/logs of {"date", "text"}. The
+        last doc_size entries are kept in memory and the whole list is sent with the new
+        ones, so the document is never read back (only once by load_cb, for the entries
+        written before the start).
+
+        Args:
+            send_cb (function): Called with {"/doc/logs": [entry, ...]} when there are new entries
+            path (str): The local log file (rotated)
+            capacity (int): Number of entries kept in memory until they are written
+            doc_size (int): Number of entries kept in the logs document (the oldest are removed)
+            flush_interval (float): Seconds between two writes
+            max_bytes (int): Size of the local file before it's rotated
+            backup_count (int): Number of rotated files kept
+            rates (dict): Rate limit (messages per second, burst) for each severity
+            load_cb (function): Called once before the first send, returns the current /doc/logs list
+        """
+        self.__send_cb = send_cb
+        self.__load_cb = load_cb
+        self.__doc = deque(maxlen=doc_size) # Entries of the logs document
+        self.__flush_interval = flush_interval
+        self.__rates = rates
+
+        self.__ring = deque(maxlen=capacity)
+        self.__lock = Lock()
+        self.__wake = Event()
+        self.__seq = 0 # Number of entries accepted
+        self.__flushed_seq = 0 # Number of entries written
+        self.__tokens = {severity: rates[severity][1] for severity in SEVERITIES}
+        self.__last_refill = monotonic()
+        self.__suppressed = 0
+        self.__overwritten = 0
+
+        self.__file = logging.getLogger("serreiot")
+        self.__file.propagate = False
+        if path is not None:
+            handler = RotatingFileHandler(path, maxBytes=max_bytes, backupCount=backup_count)
+            handler.setFormatter(logging.Formatter("%(message)s"))
+            self.__file.addHandler(handler)
+            self.__file.setLevel(logging.INFO)
+
+        self.__thread = Thread(target=self.__run, daemon=True)
+        self.__thread.start()
+
+    @staticmethod
+    def severity(msg: str) -> str:
+        '''Get the severity of a message from its prefix ([Error], [Warning], ...)'''
+        if msg.startswith("[Error]"):
+            return "error"
+        if msg.startswith("[Warning]") or msg.startswith("[Warn]"):
+            return "warning"
+        return "info"
+
+    def log(self, msg: str) -> None:
+        '''Add a message, dropped if its severity is over its rate'''
+        severity = self.severity(msg)
+
+        with self.__lock:
+            if not self.__take_token(severity):
+                self.__suppressed += 1
+                return
+
+            self.__append(msg)
+
+        print("\033[33m" + f"LOG: {msg}" + "\033[0m")
+
+    def flush(self) -> None:
+        '''Write the new entries now'''
+        self.__wake.set()
+
+    def __take_token(self, severity: str) -> bool:
+        '''Token bucket of each severity (the lock must be held)'''
+        now = monotonic()
+        elapsed = now - self.__last_refill
+        self.__last_refill = now
+
+        for name in SEVERITIES:
+            rate, burst = self.__rates[name]
+            self.__tokens[name] = min(burst, self.__tokens[name] + elapsed * rate)
+
+        if self.__tokens[severity] < 1:
+            return False
+
+        self.__tokens[severity] -= 1
+        return True
+
+    def __append(self, msg: str) -> None:
+        '''Add an entry to the ring (the lock must be held)'''
+        if len(self.__ring) == self.__ring.maxlen:
+            if self.__ring[0]["seq"] >= self.__flushed_seq:
+                self.__overwritten += 1 # Lost before being written
+
+        self.__ring.append({
+            "seq": self.__seq,
+            "date": time.strftime("%Y-%m-%d %H:%M:%S", time.localtime()),
+            "text": msg,
+        })
+        self.__seq += 1
+
+    def __take_new(self) -> list:
+        '''Get the entries not written yet, with the counters of dropped messages'''
+        with self.__lock:
+            if self.__suppressed or self.__overwritten:
+                self.__append(f"[Warning] {self.__suppressed} log messages over the rate limit "
+                              f"and {self.__overwritten} overwritten before being written")
+                self.__suppressed = 0
+                self.__overwritten = 0
+
+            entries = [entry for entry in self.__ring if entry["seq"] >= self.__flushed_seq]
+            self.__flushed_seq = self.__seq
+
+        return entries
+
+    def __run(self) -> None:
+        '''Write the new entries every flush interval'''
+        while True:
+            self.__wake.wait(self.__flush_interval)
+            self.__wake.clear()
+
+            entries = self.__take_new()
+            if not entries:
+                continue
+
+            for entry in entries:
+                self.__file.info(f"{entry['date']} - {entry['text']}")
+
+            if self.__load_cb is not None:
+                try:
+                    self.__doc.extend(self.__load_cb() or [])
+                except Exception as e:
+                    self.__file.error(f"Unable to read the logs document: {e}")
+                self.__load_cb = None
+
+            self.__doc.extend({"date": entry["date"], "text": entry["text"]} for entry in entries)
+            try:
+                self.__send_cb({"/doc/logs": list(self.__doc)})
+            except Exception as e:
+                self.__file.error(f"Unable to send {len(entries)} log entries: {e}")
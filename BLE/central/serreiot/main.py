@@ -2,57 +2,135 @@ from aliot.aliot_obj import AliotObj
 
 from device import Device
 from reader import Reader
-import time
+from uplink import UplinkBatcher
+from log_sink import LogSink
+from tsdb import TimeSeriesStore
+from rollup import Rollups
+from outbox import Outbox
+from registry import Registry
+from list_ports import dongle_ports
+from dedup import EARLIEST
+from httpd import HttpServer
+from timing import AckTracer, wall_time
+from latest import LatestCache
+from local_api import LocalApi
+from sinks import Record, NotApplied, CallbackSink, MqttSink, CsvSink
+from payload import METRICS
+import metrics
+import os
+import sqlite3
+
+UPLINK_WINDOW_S = 2.0 # Time the updates are gathered before being sent
+UPLINK_MAX_SIZE = 500 # Number of paths that triggers an early send
+LOG_FILE = "serreiot.log" # Local log file (rotated)
+LOG_DOC_SIZE = 100 # Number of entries kept in the logs document
+MISSING_VALUE = 99.99 # Value sent when a sensor is missing from the packet
+STORE_FILE = "serreiot.db" # Local history of every reading
+STORE_RETENTION_DAYS = 365 # Readings older than this are deleted
+UPLINK_RAW_VALUES = True # Send the latest raw values, the closed windows are always sent
+ROLLUP_NAMES = { 60 : '1m', 3600 : '1h', 86400 : '1d' } # Resolutions of the windows (seconds)
+OUTBOX_FOLDER = "outbox" # Updates waiting for the backend (kept across restarts)
+OUTBOX_MAX_BYTES = 50_000_000 # The oldest updates are dropped over this size
+NODES_FILE = "nodes.csv" # Nodes provisioned at startup (addr,name[,node_id][,path]), optional
+HOT_NODES = 4096 # Number of nodes whose last packet is kept in memory
+DEDUP_POLICY = EARLIEST # Copy kept when several dongles hear a packet (EARLIEST or BEST_RSSI)
+HTTP_HOST = "127.0.0.1" # Address of the local HTTP server ("0.0.0.0" to scrape the metrics from another computer)
+HTTP_PORT = 9108 # Port of the local HTTP server (metrics at /metrics, latest values at /api/nodes)
+RECENT_SAMPLES = 60 # Samples of each node kept in memory for the local API
+MQTT_HOST = None # Address of a local MQTT broker the samples are published on (e.g. "127.0.0.1"), None to disable
+MQTT_PORT = 1883
+MQTT_TOPIC = "serreiot" # Each node is published on serreiot/<node id>
+CSV_FILE = None # Rotating CSV file of every sample (e.g. "samples.csv"), None to disable
+CSV_MAX_BYTES = 10_000_000 # Size of the CSV file before it's rotated
+STORE_PUT_TIMEOUT = 30.0 # Seconds the reader waits for the local store before a sample is dropped
 
 sensor_iot = AliotObj("serreiot")
 
 def send_data(device:Device):
-    sensors_values = {
-        1 : 99.99, # temp
-        2 : 99.99, # hum
-        3 : 99.99, # lum
-        4 : 99.99, # gnd temp
-        5 : 99.99, # gnd hum
-        254 : 99.99 # bat
-    }
-
-    data_queue = device.getDataQueue()
-    while not data_queue.empty() and data_queue.qsize() >= 3:
-        val_id = data_queue.get()
-        whole_val = data_queue.get()
-        decimal_val = data_queue.get()
-
-        sensors_values[val_id] = whole_val + (decimal_val / 100)
-
-    path = f'/doc/{device.index}'
-    sensor_iot.update_doc({
-        f'{path}/humidity' : sensors_values[2],
-        f'{path}/temperature' : sensors_values[1],
-        f'{path}/luminosite' : sensors_values[3],
-        f'{path}/gnd_temperature' : sensors_values[4],
-        f'{path}/gnd_humidity' : sensors_values[5],
-        f'{path}/batterie' : sensors_values[254],
-        f'{path}/id' : device.id
-        })
-    
+    '''Give the new data of a device to every sink, each one writes it in its own thread'''
+    record = Record(device.node, device.id, wall_time(device.sampled_at), device.values, device.sampled_at, device.late)
+    for sink in sinks:
+        sink.put(record)
+
+def store_record(record: Record):
+    '''Keep the history locally, the late samples are merged in it'''
+    values = record.values
+    if record.late: # Only the values not stored yet, a copy must not be counted twice in the windows
+        try:
+            values = store.new_values(record.node.addr, record.time, values)
+        except sqlite3.Error as e: # Nothing applied yet
+            raise NotApplied(e)
+        if not values:
+            return
+    missed = rollups.add(record.node.addr, record.time, values, record.late)
+    store.append(record.node.addr, record.time, values, record.late, missed)
+
+def send_record(record: Record):
+    '''Send the latest raw values to the backend'''
+    if record.late: # Older than the values already sent, only kept in the history
+        return
+    values = record.values
+    path = record.node.path
+    if record.sampled_at is not None:
+        tracer.sent(f'{path}/id', record.counter, record.sampled_at) # Age of the sample once the backend has it
+    fields = {f'{path}/{name}' : values.get(value_id, MISSING_VALUE) for value_id, name in METRICS.items()}
+    fields[f'{path}/id'] = record.counter
+    uplink.update(fields)
+
+def send_rollup(addr: str, metric: int, resolution: int, window):
+    '''Store a closed window and send it'''
+    store.append_rollup(addr, metric, resolution, window.start, window)
+
+    node = registry.lookup(addr)
+    if node is None or metric not in METRICS:
+        return
+
+    uplink.update({
+        f'{node.path}/rollups/{ROLLUP_NAMES[resolution]}/{METRICS[metric]}' : {
+            'start' : window.start,
+            'min' : window.min,
+            'max' : window.max,
+            'mean' : round(window.mean, 2),
+            'count' : window.count,
+            'last' : window.last,
+        }
+    })
+
+def send_update(fields: dict):
+    '''Send an update of the outbox to the backend'''
+    sensor_iot.update_doc(fields)
+    tracer.acked(fields)
+
 def send_logs(msg: str):
-    logs = sensor_iot.get_doc('/doc/logs')
-    
-    data = {
-        "date":  time.strftime("%Y-%m-%d %H:%M:%S", time.localtime()),
-        "text": msg
-    }
+    log_sink.log(msg)
 
-    print("\033[33m" + f"LOG: {data['date']} - {data['text']}" + "\033[0m")
+tracer = AckTracer()
+outbox = Outbox(OUTBOX_FOLDER, send_update, send_logs, OUTBOX_MAX_BYTES, dropped_cb=lambda paths: uplink.forget(paths))
+uplink = UplinkBatcher(outbox.put, send_logs, UPLINK_WINDOW_S, UPLINK_MAX_SIZE)
+log_sink = LogSink(uplink.update, LOG_FILE, doc_size=LOG_DOC_SIZE, load_cb=lambda: sensor_iot.get_doc('/doc/logs'))
+store = TimeSeriesStore(STORE_FILE, send_logs, retention_days=STORE_RETENTION_DAYS)
+rollups = Rollups(send_rollup, tuple(ROLLUP_NAMES))
+registry = Registry(STORE_FILE, send_logs, HOT_NODES)
+if os.path.exists(NODES_FILE):
+    registry.provision(NODES_FILE)
+http = HttpServer(HTTP_HOST, HTTP_PORT, send_logs)
+http.route("/metrics", lambda path, query, headers: (200, {"Content-Type": "text/plain; version=0.0.4"}, metrics.render().encode()))
+latest = LatestCache(RECENT_SAMPLES)
+LocalApi(http, latest)
 
-    logs.append(data)
-    sensor_iot.update_doc({ '/doc/logs' : logs })
+sinks = [CallbackSink("store", store_record, send_logs, put_timeout=STORE_PUT_TIMEOUT)] # No sample lost while the database is only slow
+if UPLINK_RAW_VALUES: # The closed windows are always sent
+    sinks.append(CallbackSink("backend", send_record, send_logs))
+if MQTT_HOST is not None:
+    sinks.append(MqttSink(MQTT_HOST, MQTT_PORT, send_logs, MQTT_TOPIC))
+if CSV_FILE is not None:
+    sinks.append(CsvSink(CSV_FILE, send_logs, CSV_MAX_BYTES))
 
 def start():
     '''Main function'''
 
-    #Start the serial port reader
-    reader = Reader("COM12", 115200, send_data, send_logs)
+    #Start the serial port reader on the data channel of each dongle (second CDC ACM port), found by their USB ids
+    reader = Reader(dongle_ports, 115200, registry, send_data, send_logs, dedup_policy=DEDUP_POLICY, cache=latest)
     print("Serial port reader started")
 
 sensor_iot.on_start(callback=start)
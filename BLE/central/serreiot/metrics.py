@@ -0,0 +1,175 @@
+from threading import Lock
+from bisect import bisect_left
+
+# Seconds, from the parsing of a line (~100 us) up to a slow backend (~10 s)
+LATENCY_BUCKETS = (0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0, 30.0)
+
+_families = [] # Every metric, in declaration order
+_collectors = [] # Functions called at each scrape, they return [(name, type, help, [(labels, value)])]
+
+def _escape(value) -> str:
+    return str(value).replace("\\", "\\\\").replace('"', '\\"').replace("\n", "\\n")
+
+def _format_value(value) -> str:
+    '''Exact text of a sample value (the counters go past the 6 digits of :g)'''
+    if isinstance(value, int):
+        return str(int(value))
+    value = float(value)
+    if value != value:
+        return "NaN"
+    if value in (float("inf"), float("-inf")):
+        return "+Inf" if value > 0 else "-Inf"
+    if value.is_integer():
+        return str(int(value))
+    return repr(value)
+
+def _format_labels(names: tuple, values: tuple) -> str:
+    if not names:
+        return ""
+    return "{" + ",".join(f'{n}="{_escape(v)}"' for n, v in zip(names, values)) + "}"
+
+class _Family():
+    '''A metric and its children, one for each set of label values'''
+    TYPE = None
+
+    def __init__(self, name: str, help: str, labels: tuple = ()) -> None:
+        self.name = name
+        self.help = help
+        self.labelnames = tuple(labels)
+        self._children = {}
+        self._lock = Lock()
+        if not self.labelnames:
+            self._children[()] = self._new_child()
+        _families.append(self)
+
+    def labels(self, *values):
+        '''Get the child of a set of label values'''
+        child = self._children.get(values)
+        if child is None:
+            with self._lock:
+                child = self._children.setdefault(values, self._new_child())
+        return child
+
+    def _new_child(self):
+        raise NotImplementedError
+
+    def render(self, lines: list) -> None:
+        lines.append(f"# HELP {self.name} {self.help}")
+        lines.append(f"# TYPE {self.name} {self.TYPE}")
+        for values, child in list(self._children.items()):
+            child.render(self.name, _format_labels(self.labelnames, values), lines)
+
+class _Value():
+    __slots__ = ("value", "lock")
+
+    def __init__(self) -> None:
+        self.value = 0.0
+        self.lock = Lock()
+
+    def inc(self, amount: float = 1) -> None:
+        with self.lock:
+            self.value += amount
+
+    def dec(self, amount: float = 1) -> None:
+        with self.lock:
+            self.value -= amount
+
+    def set(self, value: float) -> None:
+        self.value = value
+
+    def render(self, name: str, labels: str, lines: list) -> None:
+        lines.append(f"{name}{labels} {_format_value(self.value)}")
+
+class _Histogram():
+    __slots__ = ("buckets", "counts", "sum", "lock")
+
+    def __init__(self, buckets: tuple) -> None:
+        self.buckets = buckets
+        self.counts = [0] * (len(buckets) + 1) # The last one is +Inf
+        self.sum = 0.0
+        self.lock = Lock()
+
+    def observe(self, value: float) -> None:
+        i = bisect_left(self.buckets, value)
+        with self.lock:
+            self.counts[i] += 1
+            self.sum += value
+
+    def render(self, name: str, labels: str, lines: list) -> None:
+        with self.lock:
+            counts = list(self.counts)
+            total = self.sum
+        prefix = labels[:-1] + "," if labels else "{"
+        cumulative = 0
+        for bound, count in zip(self.buckets, counts):
+            cumulative += count
+            lines.append(f'{name}_bucket{prefix}le="{bound:g}"}} {cumulative}')
+        cumulative += counts[-1]
+        lines.append(f'{name}_bucket{prefix}le="+Inf"}} {cumulative}')
+        lines.append(f"{name}_sum{labels} {_format_value(total)}")
+        lines.append(f"{name}_count{labels} {cumulative}")
+
+class Counter(_Family):
+    '''Value that only goes up (inc)'''
+    TYPE = "counter"
+
+    def _new_child(self):
+        return _Value()
+
+    def inc(self, amount: float = 1) -> None:
+        self._children[()].inc(amount)
+
+class Gauge(_Family):
+    '''Value that goes up and down (set, inc, dec)'''
+    TYPE = "gauge"
+
+    def _new_child(self):
+        return _Value()
+
+    def set(self, value: float) -> None:
+        self._children[()].set(value)
+
+    def inc(self, amount: float = 1) -> None:
+        self._children[()].inc(amount)
+
+    def dec(self, amount: float = 1) -> None:
+        self._children[()].dec(amount)
+
+class Histogram(_Family):
+    '''Distribution of values in fixed buckets (observe)'''
+    TYPE = "histogram"
+
+    def __init__(self, name: str, help: str, labels: tuple = (), buckets: tuple = LATENCY_BUCKETS) -> None:
+        self.buckets = tuple(sorted(buckets))
+        super().__init__(name, help, labels)
+
+    def _new_child(self):
+        return _Histogram(self.buckets)
+
+    def observe(self, value: float) -> None:
+        self._children[()].observe(value)
+
+def collector(fn) -> None:
+    """
+    Add values read at each scrape, for the counters already kept by the objects
+
+    Args:
+        fn (function): Returns a list of (name, type, help, [(labels dict, value)])
+    """
+    _collectors.append(fn)
+
+def render() -> str:
+    '''Get every metric in the Prometheus text format'''
+    lines = []
+    for family in list(_families):
+        family.render(lines)
+
+    for fn in list(_collectors):
+        for name, type, help, samples in fn():
+            lines.append(f"# HELP {name} {help}")
+            lines.append(f"# TYPE {name} {type}")
+            for labels, value in samples:
+                if value is not None:
+                    lines.append(f"{name}{_format_labels(tuple(labels), tuple(labels.values()))} {_format_value(value)}")
+
+    return "\n".join(lines) + "\n"
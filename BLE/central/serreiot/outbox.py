@@ -0,0 +1,366 @@
+from threading import Thread, Condition
+from queue import Queue, Empty
+from collections import deque
+from time import monotonic, sleep
+import json, os, random
+
+import metrics
+
+BACKEND_LATENCY = metrics.Histogram("serreiot_backend_seconds", "Duration of the calls to the backend", ("result",))
+
+def device_key(path: str) -> str:
+    '''Part of a document path that identifies the device (/doc/<index>)'''
+    end = path.find("/", 5)
+    return path[:end] if path.startswith("/doc/") and end > 0 else path
+
+class Outbox():
+
+    def __init__(self, folder, send_cb, send_logs_cb, max_bytes=50_000_000, segment_bytes=1_000_000,
+                 batch_size=50, backoff_min=1.0, backoff_max=300.0, sync_interval=1.0,
+                 workers=4, max_in_flight=256, max_tries=5, retryable=(OSError,), dropped_cb=None) -> None:
+        """
+        Durable queue of the document updates, replayed in order when the backend is reachable
+
+        The updates are appended to segment files in the folder. A cursor file keeps
+        the position of the first update not accepted by the backend, so nothing is
+        lost when the backend or the gateway is down.
+
+        The paths of each update are split by device (/doc/<index>) and each device is
+        always sent by the same worker, so several requests are in flight at once while
+        the updates of a device stay in order. The cursor only moves over the updates
+        completely sent.
+
+        A connection error (retryable) is retried until the backend is back. Any other
+        error is a rejection: after max_tries the paths are sent one by one, and the
+        ones still rejected are moved to dead.jsonl, so one bad path doesn't stall the
+        devices of its worker and the cursor moves on.
+
+        Args:
+            folder (str): The folder of the segment files
+            send_cb (function): Called with a dict {path: value}, sends it to the backend (raises on failure)
+            send_logs_cb (function): Called with each log message
+            max_bytes (int): Maximum size of the updates not read by the workers, the oldest segments are dropped over it
+            segment_bytes (int): Size of a segment file before a new one is started
+            batch_size (int): Number of paths that ends the merge of the waiting parts in one call to send_cb
+            backoff_min (float): Seconds waited after the first failure
+            backoff_max (float): Maximum seconds waited between two tries
+            sync_interval (float): Maximum seconds before the appended updates are synced to the disk
+            workers (int): Number of requests in flight at once
+            max_in_flight (int): Maximum number of parts waiting for each worker, the reading of the segments stops while it's full
+            max_tries (int): Tries of a rejected update before its paths are sent alone and the rejected ones dropped
+            retryable (tuple): Exceptions of send_cb retried without limit (backend unreachable)
+            dropped_cb (function): Called with the paths of the updates dropped (None when they're not known)
+        """
+        self.__folder = folder
+        self.__send_cb = send_cb
+        self.__send_logs_cb = send_logs_cb
+        self.__max_bytes = max_bytes
+        self.__segment_bytes = segment_bytes
+        self.__batch_size = batch_size
+        self.__backoff_min = backoff_min
+        self.__backoff_max = backoff_max
+        self.__sync_interval = sync_interval
+        self.__max_tries = max_tries
+        self.__retryable = retryable
+        self.__dropped_cb = dropped_cb or (lambda paths: None)
+
+        self.__cond = Condition()
+        self.__sent = 0
+        self.__dropped = 0
+        self.__stalls = 0
+        self.__failed = 0
+        self.__dead = 0
+        self.__unsynced = False
+        self.__records = deque() # [parts not sent, segment, offset after, updates] of each record read, in order
+
+        os.makedirs(folder, exist_ok=True)
+        self.__segments = sorted(int(name[:-6]) for name in os.listdir(folder) if name.endswith(".jsonl") and name[:-6].isdigit())
+        self.__cursor_segment, self.__cursor_offset = self.__load_cursor()
+
+        if not self.__segments:
+            self.__segments.append(1)
+        self.__write_file = open(self.__segment_path(self.__segments[-1]), "ab")
+        self.__drop_torn_line()
+
+        # Position of the next record to read (after the records in flight)
+        self.__read_segment, self.__read_offset = self.__cursor_segment, self.__cursor_offset
+        self.__read_file = None
+
+        self.__queues = [Queue(max_in_flight) for _ in range(workers)]
+        for queue in self.__queues:
+            Thread(target=self.__work, args=(queue,), daemon=True).start()
+
+        self.__thread = Thread(target=self.__dispatch, daemon=True)
+        self.__thread.start()
+
+        metrics.collector(lambda: [
+            ("serreiot_outbox_pending_bytes", "gauge", "Size of the updates not accepted by the backend", [({}, self.pending_bytes)]),
+            ("serreiot_outbox_in_flight", "gauge", "Updates read and not completely sent", [({}, self.in_flight)]),
+            ("serreiot_outbox_sent_total", "counter", "Updates accepted by the backend", [({}, self.__sent)]),
+            ("serreiot_outbox_dropped_total", "counter", "Updates dropped (outbox full or corrupted)", [({}, self.__dropped)]),
+            ("serreiot_outbox_failed_total", "counter", "Calls to the backend that failed", [({}, self.__failed)]),
+            ("serreiot_outbox_dead_total", "counter", "Paths rejected by the backend, moved to dead.jsonl", [({}, self.__dead)]),
+            ("serreiot_outbox_stalls_total", "counter", "Times the reading waited for a worker", [({}, self.__stalls)]),
+        ])
+
+    @property
+    def pending_bytes(self) -> int:
+        '''Size of the updates not sent yet'''
+        with self.__cond:
+            return self.__bytes_from(self.__cursor_segment, self.__cursor_offset)
+
+    @property
+    def in_flight(self) -> int:
+        '''Number of updates read and not completely sent yet'''
+        return len(self.__records)
+
+    @property
+    def stalls(self) -> int:
+        '''Number of times the reading waited for a worker (backpressure of a slow backend)'''
+        return self.__stalls
+
+    @property
+    def sent(self) -> int:
+        '''Number of updates accepted by the backend'''
+        return self.__sent
+
+    @property
+    def dead(self) -> int:
+        '''Number of paths rejected by the backend and moved to the dead letters'''
+        return self.__dead
+
+    @property
+    def dropped(self) -> int:
+        '''Number of updates dropped because the outbox was full (or corrupted)'''
+        return self.__dropped
+
+    def put(self, update: dict) -> None:
+        '''Append an update, it's sent in order after the previous ones'''
+        line = json.dumps(update, separators=(",", ":")).encode() + b"\n"
+
+        with self.__cond:
+            if self.__write_file.tell() + len(line) > self.__segment_bytes and self.__write_file.tell() > 0:
+                self.__new_segment()
+
+            self.__write_file.write(line)
+            self.__write_file.flush()
+            self.__unsynced = True
+
+            while self.__bytes_from(self.__read_segment, self.__read_offset) > self.__max_bytes and self.__read_segment != self.__segments[-1]:
+                self.__drop_read_segment()
+
+            self.__cond.notify()
+
+    def __segment_path(self, segment: int) -> str:
+        return os.path.join(self.__folder, f"{segment:08d}.jsonl")
+
+    def __load_cursor(self) -> tuple:
+        '''Get the position of the first update not sent (segment, offset)'''
+        try:
+            with open(os.path.join(self.__folder, "cursor")) as f:
+                segment, offset = (int(v) for v in f.read().split())
+        except (OSError, ValueError):
+            segment, offset = 0, 0
+
+        if segment not in self.__segments: # Start at the oldest segment
+            segment = self.__segments[0] if self.__segments else 1
+            offset = 0
+
+        return segment, offset
+
+    def __save_cursor(self) -> None:
+        '''Save the position atomically (the lock must be held)'''
+        path = os.path.join(self.__folder, "cursor")
+        with open(path + ".tmp", "w") as f:
+            f.write(f"{self.__cursor_segment} {self.__cursor_offset}")
+            f.flush()
+            os.fsync(f.fileno())
+        os.replace(path + ".tmp", path)
+
+    def __bytes_from(self, segment: int, offset: int) -> int:
+        '''Size of the updates after a position (the lock must be held)'''
+        total = -offset
+        for s in self.__segments:
+            if s >= segment:
+                total += self.__write_file.tell() if s == self.__segments[-1] else os.path.getsize(self.__segment_path(s))
+        return total
+
+    def __drop_torn_line(self) -> None:
+        '''Remove the end of the last segment if it was not completely written (crash during a write)'''
+        with open(self.__segment_path(self.__segments[-1]), "rb") as f:
+            data = f.read()
+        end = data.rfind(b"\n") + 1
+        if end < len(data):
+            self.__write_file.truncate(end)
+            self.__write_file.seek(end)
+            self.__dropped += 1
+            if self.__cursor_segment == self.__segments[-1]:
+                self.__cursor_offset = min(self.__cursor_offset, end)
+
+    def __new_segment(self) -> None:
+        '''Start a new segment file (the lock must be held)'''
+        os.fsync(self.__write_file.fileno())
+        self.__write_file.close()
+        self.__segments.append(self.__segments[-1] + 1)
+        self.__write_file = open(self.__segment_path(self.__segments[-1]), "ab")
+
+    def __drop_read_segment(self) -> None:
+        '''Skip the updates not read of the oldest segment to stay under max_bytes (the lock must be held)'''
+        with open(self.__segment_path(self.__read_segment), "rb") as f:
+            f.seek(self.__read_offset)
+            dropped = sum(1 for _ in f)
+
+        self.__dropped += dropped
+        self.__read_segment = self.__segments[self.__segments.index(self.__read_segment) + 1]
+        self.__read_offset = 0
+        self.__records.append([0, self.__read_segment, 0, 0]) # The cursor can move over the skipped updates
+        self.__advance()
+
+        self.__dropped_cb(None)
+        self.__send_logs_cb(f"[Warning] Outbox full, {dropped} updates dropped ({self.__dropped} in total)")
+
+    def __read_record(self):
+        '''Read the next record (the lock must be held), returns its line or None if there is none yet'''
+        while True:
+            if self.__read_file is None or self.__read_file.name != self.__segment_path(self.__read_segment):
+                if self.__read_file is not None:
+                    self.__read_file.close()
+                self.__read_file = open(self.__segment_path(self.__read_segment), "rb")
+
+            self.__read_file.seek(self.__read_offset)
+            line = self.__read_file.readline()
+
+            if line.endswith(b"\n"):
+                self.__read_offset += len(line)
+                return line
+
+            if line or self.__read_segment == self.__segments[-1]:
+                return None # Not completely written yet
+
+            # End of a finished segment, continue with the next one
+            self.__read_segment = self.__segments[self.__segments.index(self.__read_segment) + 1]
+            self.__read_offset = 0
+
+    def __advance(self) -> None:
+        '''Move the cursor over the records completely sent and delete the finished segments (the lock must be held)'''
+        moved = False
+        while self.__records and self.__records[0][0] == 0:
+            _, self.__cursor_segment, self.__cursor_offset, updates = self.__records.popleft()
+            self.__sent += updates
+            moved = True
+
+        if not moved:
+            return
+
+        self.__save_cursor()
+        while self.__segments[0] < self.__cursor_segment:
+            os.remove(self.__segment_path(self.__segments.pop(0)))
+
+    def __dispatch(self) -> None:
+        '''Read the records in order and give the paths of each device to its worker'''
+        last_sync = monotonic()
+
+        while True:
+            with self.__cond:
+                while True:
+                    if self.__unsynced and monotonic() - last_sync >= self.__sync_interval:
+                        os.fsync(self.__write_file.fileno())
+                        self.__unsynced = False
+                        last_sync = monotonic()
+
+                    line = self.__read_record()
+                    if line is not None:
+                        break
+                    self.__cond.wait(self.__sync_interval if self.__unsynced else None)
+
+                try:
+                    update = json.loads(line)
+                except ValueError:
+                    update = None
+                    self.__dropped += 1 # Corrupted by a crash
+                    self.__dropped_cb(None)
+
+                parts = {} # Paths of the update for each worker
+                for path, value in (update or {}).items():
+                    parts.setdefault(hash(device_key(path)) % len(self.__queues), {})[path] = value
+
+                record = [len(parts), self.__read_segment, self.__read_offset, 0 if update is None else 1]
+                self.__records.append(record)
+                self.__advance() # Nothing to send for an empty or corrupted record
+
+            for worker, fields in parts.items():
+                queue = self.__queues[worker]
+                if queue.full():
+                    self.__stalls += 1
+                queue.put((fields, record)) # Blocks while the worker is behind
+
+    def __send_alone(self, merged: dict, error: Exception) -> dict:
+        '''Send each path of a rejected update alone, the rejected ones are dead, returns the paths left when unreachable'''
+        if len(merged) == 1:
+            self.__dead_letter(merged, error)
+            return {}
+
+        paths = list(merged.items())
+        for i, (path, value) in enumerate(paths):
+            try:
+                self.__send_cb({path: value})
+            except self.__retryable:
+                self.__failed += 1
+                return dict(paths[i:]) # Tried again as usual
+            except Exception as e:
+                self.__failed += 1
+                self.__dead_letter({path: value}, e)
+        return {}
+
+    def __dead_letter(self, fields: dict, error: Exception) -> None:
+        '''Keep the paths rejected by the backend in dead.jsonl (up to segment_bytes) and log them'''
+        line = json.dumps({"error": str(error), "update": fields}, separators=(",", ":")).encode() + b"\n"
+        path = os.path.join(self.__folder, "dead.jsonl")
+        with self.__cond:
+            self.__dead += len(fields)
+            if not os.path.exists(path) or os.path.getsize(path) + len(line) <= self.__segment_bytes:
+                with open(path, "ab") as f:
+                    f.write(line)
+        self.__dropped_cb(list(fields))
+        self.__send_logs_cb(f"[Error] Backend rejected {', '.join(fields)}, dropped ({self.__dead} in total): {error}")
+
+    def __work(self, queue: Queue) -> None:
+        '''Send the parts of a set of devices in order, waits longer after each failure'''
+        backoff = 0
+        ok = BACKEND_LATENCY.labels("ok")
+        error = BACKEND_LATENCY.labels("error")
+
+        while True:
+            parts = [queue.get()]
+            merged = dict(parts[0][0])
+            while len(merged) < self.__batch_size:
+                try:
+                    parts.append(queue.get_nowait())
+                except Empty:
+                    break
+                merged.update(parts[-1][0]) # In order, the newer values win
+
+            tries = 0 # Rejections in a row
+            while merged:
+                start = monotonic()
+                try:
+                    self.__send_cb(merged)
+                    ok.observe(monotonic() - start)
+                    break
+                except Exception as e:
+                    error.observe(monotonic() - start)
+                    self.__failed += 1
+                    tries = 0 if isinstance(e, self.__retryable) else tries + 1
+                    if tries >= self.__max_tries: # Rejected, not only unreachable
+                        merged = self.__send_alone(merged, e)
+                        tries = 0
+                        continue
+                    backoff = min(self.__backoff_max, max(self.__backoff_min, backoff * 2))
+                    self.__send_logs_cb(f"[Error] Unable to send {len(merged)} paths, next try in {backoff:.1f} s: {e}")
+                    sleep(backoff * random.uniform(0.8, 1.2))
+
+            backoff = 0
+            with self.__cond:
+                for _, record in parts:
+                    record[0] -= 1
+                self.__advance()
@@ -0,0 +1,76 @@
+# Layout of the service data
+# Generated by BLE/payload/gen_payload.py from BLE/payload/payload.json, do not edit.
+from struct import Struct
+
+SERVICE_UUID = b"\xab\xcd"
+FORMAT_VERSION = 0
+DEFAULT_SCALE = 100 # The decimal part of a pair is in 1 / scale
+
+HEADER = Struct("2sBB") # Service UUID, format version, counter
+PAIR = Struct("BBB") # Value id, whole part, decimal part
+
+TEMPERATURE_ID = 1 # Air temperature (AHT20)
+HUMIDITY_ID = 2 # Air humidity (AHT20)
+LUMINOSITE_ID = 3 # Luminosity (PT19)
+GND_TEMPERATURE_ID = 4 # Ground temperature
+GND_HUMIDITY_ID = 5 # Ground humidity
+BATTERIE_ID = 254 # Battery voltage
+SAMPLE_AGE_ID = 253 # Seconds since the reading, updated while advertising
+
+# Name of each value id
+METRICS = {
+    1: "temperature",
+    2: "humidity",
+    3: "luminosite",
+    4: "gnd_temperature",
+    5: "gnd_humidity",
+    254: "batterie",
+}
+
+# Scale of each value id
+SCALES = {
+    1: 100,
+    2: 100,
+    3: 100,
+    4: 100,
+    5: 100,
+    254: 100,
+    253: 100,
+}
+
+# Layout sent by the broadcaster: header followed by 7 pairs
+LAYOUT = Struct(HEADER.format + PAIR.format * 7)
+AGE_ID = SAMPLE_AGE_ID # Pair with the age of the reading (seconds), not a value
+
+
+def decode_layout(data: bytes) -> tuple:
+    '''Decode a payload of LAYOUT.size bytes: (uuid, version, counter, {value id: value})'''
+    (uuid, version, counter,
+     id0, whole0, decimal0,
+     id1, whole1, decimal1,
+     id2, whole2, decimal2,
+     id3, whole3, decimal3,
+     id4, whole4, decimal4,
+     id5, whole5, decimal5,
+     id6, whole6, decimal6) = LAYOUT.unpack(data)
+    return uuid, version, counter, {
+        id0: (whole0 * 100 + decimal0) / 100,
+        id1: (whole1 * 100 + decimal1) / 100,
+        id2: (whole2 * 100 + decimal2) / 100,
+        id3: (whole3 * 100 + decimal3) / 100,
+        id4: (whole4 * 100 + decimal4) / 100,
+        id5: (whole5 * 100 + decimal5) / 100,
+        id6: (whole6 * 100 + decimal6) / 100,
+    }
+
+
+def encode_payload(counter: int, values: dict) -> bytes:
+    '''Encode a payload with the pairs of values ({value id: value}, in this order), for the tools and tests'''
+    data = bytearray(HEADER.pack(SERVICE_UUID, FORMAT_VERSION, counter & 0xff))
+    for value_id, value in values.items():
+        scale = SCALES.get(value_id, DEFAULT_SCALE)
+        n = value * scale
+        n = int(n + 0.5) if n >= 0 else -int(0.5 - n) # Half away from zero, like lroundf of the broadcaster
+        whole, decimal = divmod(n, scale) # 2.999 carries into 3.00
+        data += PAIR.pack(value_id, whole & 0xff, decimal)
+    return bytes(data)
@@ -1,116 +1,362 @@
-from threading import Thread
-from queue import Queue
-from time import sleep
-import serial, re
+from threading import Thread, Lock, Event
+from queue import Queue, Empty
+from time import monotonic
+import serial
 
+from decoder import decode_line, DecodeError
 from device import Device
+from dedup import Deduplicator, EARLIEST
+from sequence import SequenceTracker, ACCEPTED, REBOOT, NEW, LATE, DUPLICATE, STALE, RESYNC, HELD
+from timing import ClockOffset, STAGE_LATENCY, SAMPLE_AGE
+import metrics
+
+SEQUENCE = metrics.Counter("serreiot_sequence_total", "Packets kept by the deduplication, by result of the counter check", ("result",))
+SEQUENCE_RESULTS = {status: SEQUENCE.labels(name) for status, name in
+                    ((NEW, "new"), (LATE, "late"), (DUPLICATE, "duplicate"), (STALE, "stale"), (REBOOT, "reboot"), (RESYNC, "resync"),
+                     (HELD, "held"))}
+
+class ReceiverStats():
+    '''Counters of one dongle'''
+    __slots__ = ("port", "connected", "disconnects", "lines", "errors", "packets", "forwarded", "rssi_sum", "rssi_count",
+                 "truncated", "dongle_dropped", "dongle_nodes", "clock")
+
+    def __init__(self, port: str) -> None:
+        self.port = port
+        self.connected = False
+        self.disconnects = 0
+        self.lines = 0 # Data lines read
+        self.errors = 0 # Lines that could not be decoded
+        self.packets = 0 # Valid packets
+        self.forwarded = 0 # Packets kept by the deduplication
+        self.rssi_sum = 0
+        self.rssi_count = 0
+        self.truncated = 0 # %trunc frames of the dongle
+        self.dongle_dropped = 0 # Lines dropped by the dongle while its data port was not read (%drop)
+        self.dongle_nodes = {} # Last %stats of the dongle for each address (rx, unique, lost, truncated)
+        self.clock = ClockOffset() # Uptime of the dongle -> host time, from the %time frames
+
+    @property
+    def duplicates(self) -> int:
+        '''Packets also heard by another dongle, whose copy was kept'''
+        return self.packets - self.forwarded
+
+    @property
+    def rssi_mean(self) -> float:
+        return self.rssi_sum / self.rssi_count if self.rssi_count else None
 
 class Reader():
 
-    def __init__(self, port, baudrate, send_data_cb, send_logs_cb) -> None:
-        self.__ser = serial.Serial(port, baudrate)
+    def __init__(self, ports, baudrate, registry, send_data_cb, send_logs_cb, queue_size=4096, uplink_queue_size=1024,
+                 reconnect_interval=0.05, discover_interval=1.0, dedup_window=2.0, dedup_policy=EARLIEST, dedup_hold=0.1,
+                 cache=None) -> None:
+        """
+        Read the data lines of the dongles and send the valid ones
+
+        Each dongle is read by its own thread and all the lines are parsed by one thread.
+        A packet heard by several dongles is only sent once (see Deduplicator).
+
+        Args:
+            ports (str, list or function): The serial ports of the data channels, or a function that finds them
+            baudrate (int): The baudrate of the serial ports
+            registry (Registry): The nodes and the last Device of each address
+            send_data_cb (function): Called with the Device each time it has new data
+            send_logs_cb (function): Called with each log message
+            queue_size (int): Maximum number of lines waiting to be parsed, the serial ports are not read while it's full
+            uplink_queue_size (int): Maximum number of devices waiting for send_data_cb, the parsing stops while it's full
+            reconnect_interval (float): Seconds between two searches of the ports while none is open or one was just lost
+            discover_interval (float): Seconds between two searches of new ports otherwise
+            dedup_window (float): Seconds a packet is remembered to drop its copies
+            dedup_policy (str): Copy kept when several dongles hear a packet (EARLIEST or BEST_RSSI)
+            dedup_hold (float): Seconds the copies are gathered with BEST_RSSI
+            cache (LatestCache): Updated with each accepted packet, before the uplink (optional)
+        """
+        self.__ports = ports
+        self.__baudrate = baudrate
+        self.__reconnect_interval = reconnect_interval
+        self.__discover_interval = discover_interval
         self.__send_data_cb = send_data_cb
         self.__send_logs_cb = send_logs_cb
-        self.__input_buffer = Queue() 
-        self.__devices = {}
-        self.__sleep_time = 0.01
+        self.__input_buffer = Queue(queue_size)
+        self.__registry = registry
+        self.__cache = cache
+        self.__dedup = Deduplicator(dedup_window, dedup_policy, dedup_hold)
+        self.__uplink_buffer = Queue(uplink_queue_size)
+        self.__stalls = 0 # Number of times the parser waited for send_data_cb
 
-        self.__read_thread = Thread(target=self.__read, daemon=True)
-        self.__read_thread.start()
+        self.__receivers = {} # ReceiverStats of each port
+        self.__sources_lock = Lock()
+        self.__lost_at = 0 # Time a port was lost
+        self.__lost = Event() # Wakes the search of the ports up
+
+        self.__sample_latency = STAGE_LATENCY.labels("sample") # Reading of the broadcaster -> reception by the dongle
+        self.__dongle_latency = STAGE_LATENCY.labels("dongle") # Reception by the dongle -> line read (buffer and USB)
+        self.__read_age = SAMPLE_AGE.labels("read")
+        self.__ingest_latency = STAGE_LATENCY.labels("ingest") # Line read -> device handed over
+        self.__queue_latency = STAGE_LATENCY.labels("uplink_queue") # Handed over -> send_data called
+        self.__send_latency = STAGE_LATENCY.labels("send_data")
+        metrics.collector(self.__collect)
+
+        self.__discover_thread = Thread(target=self.__discover, daemon=True)
+        self.__discover_thread.start()
 
         self.__input_buffer_parser_thread = Thread(target=self.__input_buffer_parser)
         self.__input_buffer_parser_thread.start()
 
-    def __read(self):
-        while(True):
-            line = ""
-            err = ""
-            if  self.__ser .in_waiting > 0:
-                try:
-                    line =  self.clean_str(self.__ser .readline().decode('utf-8').rstrip())
-                except UnicodeDecodeError as e:
-                    line =  self.clean_str(self.__ser .readline().decode('utf-8', 'replace').rstrip())
-                    error_position = e.args[2]
-                    err = f"[Error] Decoding error occurred at {error_position} for line: {line}"
-                    
-            if line == "": # Check if the line is empty
-                sleep(self.__sleep_time)
-                continue
+        self.__uplink_thread = Thread(target=self.__uplink, daemon=True)
+        self.__uplink_thread.start()
 
-            if err != "": # Check if there is an error
-                self.__send_logs_cb(err) # Send the error
-            
-            if line[0] == "[" : # Check if the line is a log
-                self.__send_logs_cb(line)
-                sleep(self.__sleep_time)
-                continue
-            
-            if not self.__is_valid(line): # Check if the data is valid
-                sleep(self.__sleep_time)
-                continue
+    @property
+    def stalls(self) -> int:
+        '''Number of times the parser waited because send_data_cb was behind (backpressure)'''
+        return self.__stalls
+
+    @property
+    def uplink_backlog(self) -> int:
+        '''Number of devices waiting for send_data_cb'''
+        return self.__uplink_buffer.qsize()
+
+    def receiver_stats(self) -> dict:
+        '''Get the ReceiverStats of each port ever opened'''
+        with self.__sources_lock:
+            return dict(self.__receivers)
+
+    def __collect(self) -> list:
+        '''Values of the metrics endpoint'''
+        receivers = self.receiver_stats().values()
+        per_port = lambda attr: [({"port": r.port}, getattr(r, attr)) for r in receivers]
+        dongle = lambda i: [({"port": r.port}, sum(n[i] for n in list(r.dongle_nodes.values()))) for r in receivers]
+        trackers = [d.sequence for d in self.__registry.devices()]
+
+        return [
+            ("serreiot_receiver_connected", "gauge", "1 while the port of the dongle is open", per_port("connected")),
+            ("serreiot_receiver_disconnects_total", "counter", "Number of times the port was lost", per_port("disconnects")),
+            ("serreiot_lines_total", "counter", "Data lines read", per_port("lines")),
+            ("serreiot_decode_errors_total", "counter", "Data lines rejected by the decoder", per_port("errors")),
+            ("serreiot_packets_total", "counter", "Valid packets", per_port("packets")),
+            ("serreiot_duplicates_total", "counter", "Packets dropped because another copy was kept", per_port("duplicates")),
+            ("serreiot_rssi_mean_dbm", "gauge", "Mean RSSI of the packets", per_port("rssi_mean")),
+            ("serreiot_dongle_rx_total", "counter", "Reports received by the dongle (%stats)", dongle(0)),
+            ("serreiot_dongle_unique_total", "counter", "New counters received by the dongle (%stats)", dongle(1)),
+            ("serreiot_dongle_lost_total", "counter", "Counters missed by the dongle (%stats)", dongle(2)),
+            ("serreiot_dongle_truncated_total", "counter", "Truncated reports (%trunc)", per_port("truncated")),
+            ("serreiot_dongle_dropped_total", "counter", "Lines dropped by the dongle, its data port full (%drop)", per_port("dongle_dropped")),
+            ("serreiot_input_queue", "gauge", "Lines waiting to be parsed", [({}, self.__input_buffer.qsize())]),
+            ("serreiot_uplink_queue", "gauge", "Devices waiting for send_data", [({}, self.uplink_backlog)]),
+            ("serreiot_parser_stalls_total", "counter", "Times the parser waited for send_data", [({}, self.__stalls)]),
+            ("serreiot_hot_nodes", "gauge", "Nodes in the hot state", [({}, len(trackers))]),
+            ("serreiot_sequence_lost", "gauge", "Counters missed by the nodes in the hot state", [({}, sum(t.lost for t in trackers))]),
+        ]
+
+    def __find_ports(self) -> list:
+        ports = self.__ports() if callable(self.__ports) else self.__ports
+        if ports is None:
+            return []
+        return [ports] if isinstance(ports, str) else list(ports)
+
+    def __discover(self) -> None:
+        '''Start a source for each port not read yet'''
+        while True:
+            for port in self.__find_ports():
+                with self.__sources_lock:
+                    stats = self.__receivers.setdefault(port, ReceiverStats(port))
+                    if stats.connected:
+                        continue
+                    try:
+                        ser = serial.Serial(port, self.__baudrate, timeout=None) # Blocking reads
+                    except (OSError, serial.SerialException):
+                        continue
+                    stats.connected = True
+
+                self.__send_logs_cb(f"[Info] Dongle connected on {port}")
+                Thread(target=self.__source, args=(ser, stats), daemon=True).start()
+
+            with self.__sources_lock:
+                connected = any(stats.connected for stats in self.__receivers.values())
+            lost = not connected or monotonic() - self.__lost_at < 5
+            self.__lost.wait(self.__reconnect_interval if lost else self.__discover_interval)
+            self.__lost.clear()
+
+    def __source(self, ser, stats: ReceiverStats) -> None:
+        '''Read a serial port until it's lost'''
+        try:
+            self.__read_lines(ser, stats)
+        except (OSError, serial.SerialException) as e:
+            self.__send_logs_cb(f"[Warning] Dongle disconnected from {stats.port}: {e}")
+
+        try:
+            ser.close()
+        except (OSError, serial.SerialException):
+            pass
+
+        with self.__sources_lock:
+            stats.connected = False
+            stats.disconnects += 1
+            self.__lost_at = monotonic()
+        self.__lost.set()
+
+    def __read_lines(self, ser, stats: ReceiverStats) -> None:
+        '''Split the bytes of a serial port in lines, blocks until bytes are available'''
+        pending = b""
+        while True:
+            # Wait for at least one byte, then take everything already received
+            chunk = ser.read(max(1, ser.in_waiting))
+            if not chunk: # End of file, the port is gone
+                raise serial.SerialException("no data")
+            read_at = monotonic()
+
+            lines = (pending + chunk).split(b"\n")
+            pending = lines.pop() # The last part is not a complete line yet
+
+            for raw in lines:
+                raw = raw.rstrip()
+
+                if raw == b"": # Check if the line is empty
+                    continue
 
-            # Add the data to the input buffer so it's treated in order
-            self.__input_buffer.put(line)
+                if raw[0] == 0x25: # Check if the line is a frame from the dongle (starts with %)
+                    self.__dongle_frame(raw, stats, read_at)
+                    continue
+
+                stats.lines += 1
+                # Add the data to the input buffer so it's treated in order (blocks while the buffer is full)
+                self.__input_buffer.put((stats, raw, read_at))
+
+    def __dongle_frame(self, raw: bytes, stats: ReceiverStats, read_at: float) -> None:
+        '''Keep the counters and the clock of the dongle (%stats,addr,rx,unique,lost,rssi_mean,rssi_var,iat_ms,truncated,
+        %trunc,addr,len, %drop,lines and %time,uptime_ms)'''
+        fields = raw.split(b",")
+        try:
+            if fields[0] == b"%time" and len(fields) == 2:
+                stats.clock.sample(int(fields[1]) / 1000, read_at)
+            elif fields[0] == b"%stats" and len(fields) == 9:
+                stats.dongle_nodes[fields[1]] = (int(fields[2]), int(fields[3]), int(fields[4]), int(fields[8]))
+            elif fields[0] == b"%trunc":
+                stats.truncated += 1
+            elif fields[0] == b"%drop" and len(fields) == 2:
+                stats.dongle_dropped += int(fields[1])
+        except ValueError:
+            pass
 
-    
     def __input_buffer_parser(self) -> None:
         '''Parse the input buffer'''
         while True:
-            if  self.__input_buffer.empty(): # Check if the input buffer is empty
-                sleep(self.__sleep_time)
-                continue
- 
-            line = self.__input_buffer.get(0) # Get the data from the input buffer
+            deadline = self.__dedup.next_deadline()
+            try: # Wait for the next line, or the end of a hold time
+                stats, line, read_at = self.__input_buffer.get(timeout=None if deadline is None else max(0, deadline - monotonic()))
+            except Empty:
+                line = None
 
-            print("\033[32mDATA: {}\033[0m".format(line))
+            now = monotonic()
+            for held in self.__dedup.due(now): # Copies kept after their hold time
+                self.__accept(*held, now)
 
-            device = Device(line) # Create a new device from the data
-
-            if device.id == -1: # Check if the device is valid
-                self.__send_logs_cb(f"[Error] The device is not valid for line: {line}")
-                sleep(self.__sleep_time)
-                continue
-            
-            if device.addr not in self.__devices: # Check if the device is already in the list
-                self.__devices[device.addr] = device # Add the device to the list
-                self.__send_data_cb(device) # Send the data
-                sleep(self.__sleep_time)
+            if line is None:
                 continue
-            
-            # Check if the device has not the same id as last time
-            if device.id > self.__devices[device.addr].id or abs(device.id - self.__devices[device.addr].id) > 5:
-                self.__send_data_cb(device) # Send the data
-                self.__devices[device.addr] = device # Update the device
-                sleep(self.__sleep_time)
+
+            try:
+                packet = decode_line(line)
+            except DecodeError as e:
+                stats.errors += 1
+                self.__send_logs_cb(f"[Error] {e} for line: {line.decode('utf-8', 'replace')} ({stats.port})")
                 continue
-            
-            sleep(self.__sleep_time)
-            continue
-
-    def __is_valid(self, data) -> bool:
-        '''Check if the data is valid in this format ({name,addr,data})'''
-        if data[0] != "{" or data[-1] != "}": # Check if the data has the right format
-            self.__send_logs_cb(f"[Error] The data is not in the right format for line: {data}")
-            return False
-        
-        if data.count("{") > 1 or data.count("}") > 1: # Check if there is more than one {} in the data
-            self.__send_logs_cb(f"[Error] There is more than one {{}} in the data for line: {data}")
-            return False
-        
-        if data.count(",") != 2: # Check if there is the right amount of commas
-            self.__send_logs_cb(f"[Error] There is not the right amount of commas for line: {data}")
-            return False
-        
-        return True
-    
-
-    def clean_str(self, string) -> str:
-        '''Remove all ANSI escape sequences and the prompt'''
-        string = re.sub(r'\x1b\[.*?[@-~]', '', string)  # Remove all ANSI escape sequences
-        string = re.sub(r'uart:~\$ ', '', string)  # Remove the prompt
-        string = string.replace('^[[1;32mua', '')  # Remove the specified string
-
-        return string
-            
-
-            
+
+            stats.packets += 1
+            if packet.rssi is not None:
+                stats.rssi_sum += packet.rssi
+                stats.rssi_count += 1
+
+            # Only one copy of a packet heard by several dongles
+            kept = self.__dedup.offer((packet.addr, packet.counter), packet.rssi, (stats, packet, read_at), now)
+            if kept is not None:
+                self.__accept(*kept, now)
+
+    def __accept(self, stats: ReceiverStats, packet, read_at: float, now: float) -> None:
+        '''Update the device of a packet kept by the deduplication'''
+        stats.forwarded += 1
+        device = self.__registry.get(packet.addr)
+
+        if device is None: # Check if the device is already known
+            node = self.__registry.node(packet.addr.decode("ascii", "replace"), packet.name.decode("utf-8", "replace"))
+            device = Device(packet, node, SequenceTracker())
+            SEQUENCE_RESULTS[device.sequence.check(packet.counter, now)].inc()
+            self.__registry.put(packet.addr, device) # Add the device to the hot state
+            self.__hand_over(stats, packet, device, read_at)
+            return
+
+        # Check if the counter is a new one (wrap, reboot and losses are handled by the tracker)
+        status = device.sequence.check(packet.counter, now)
+        SEQUENCE_RESULTS[status].inc()
+        if status == DUPLICATE and device.sequence.reboot_seq is not None:
+            return # A copy of the packet held
+        held = device.release() # Dropped unless the reboot is confirmed, it was a stray copy
+        if status == HELD:
+            device.hold((stats, packet, read_at))
+        elif status in ACCEPTED:
+            if status == REBOOT:
+                self.__send_logs_cb(f"[Info] {device.name} ({device.addr}) rebooted, counter {device.id} -> {packet.counter}")
+                if device.sequence.confirmed and held is not None: # The first counter after the reboot
+                    self.__hand_over(held[0], held[1], device, held[2])
+            self.__hand_over(stats, packet, device, read_at)
+        elif status == LATE: # A counter missed until now, its sample goes in the history but not in the latest values
+            self.__hand_over(stats, packet, device, read_at, late=True)
+
+    def __sampled_at(self, stats: ReceiverStats, packet, read_at: float) -> float:
+        '''Host time of the reading of a packet, from the timestamps of the dongle and the broadcaster when they are sent'''
+        received_at = None
+        if packet.rx_ms is not None:
+            received_at = stats.clock.to_host(packet.rx_ms / 1000)
+        if received_at is not None:
+            self.__dongle_latency.observe(max(0.0, read_at - received_at))
+        else:
+            received_at = read_at # Upper bound
+
+        if packet.age is None:
+            return received_at
+        self.__sample_latency.observe(packet.age)
+        sampled_at = received_at - packet.age
+        self.__read_age.observe(read_at - sampled_at)
+        return sampled_at
+
+    def __hand_over(self, stats: ReceiverStats, packet, device: Device, read_at: float, late=False) -> None:
+        """
+        Give the data to the uplink thread, blocks while it's behind
+
+        A late counter without the age of its sample is dated from the newest counter of the
+        node, one period per counter behind it (the reception time would misfile it).
+        A new counter whose sample is older than the previous one (a node sending its
+        buffered samples) is late too. The late samples don't update the latest values.
+
+        Args:
+            late (bool): The counter was missed and is received after a newer one (LATE)
+        """
+        sampled_at = self.__sampled_at(stats, packet, read_at)
+        tracker = device.sequence
+        if late:
+            if packet.age is None and device.sampled_at is not None and tracker.period is not None:
+                sampled_at = device.sampled_at - tracker.behind(packet.counter) * tracker.period
+        else:
+            replayed = device.sampled_at is not None and sampled_at < device.sampled_at
+            device.update(packet, sampled_at) # The newest counter and the time of its sample
+            late = replayed
+
+        if not late and self.__cache is not None: # The local API does not wait for the uplink
+            self.__cache.update(device.node, packet.counter, packet.values, sampled_at)
+
+        if self.__uplink_buffer.full():
+            self.__stalls += 1
+            if self.__stalls == 1 or self.__stalls % 1000 == 0:
+                self.__send_logs_cb(f"[Warning] Uplink behind, parsing paused ({self.__stalls} times)")
+
+        # A copy, the device of the list keeps changing while this one waits
+        now = monotonic()
+        self.__ingest_latency.observe(now - read_at)
+        self.__uplink_buffer.put((Device(packet, device.node, sampled_at=sampled_at, late=late), now))
+
+    def __uplink(self) -> None:
+        '''Send the new data, apart from the parser so it never waits for the backend'''
+        while True:
+            device, handed_at = self.__uplink_buffer.get()
+            start = monotonic()
+            self.__queue_latency.observe(start - handed_at)
+            self.__send_data_cb(device)
+            self.__send_latency.observe(monotonic() - start)
@@ -0,0 +1,181 @@
+from threading import Lock
+from collections import OrderedDict
+import csv, sqlite3, sys
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS nodes (
+    addr TEXT PRIMARY KEY,
+    node_id INTEGER NOT NULL UNIQUE,
+    name TEXT NOT NULL,
+    path TEXT NOT NULL UNIQUE -- document path of the node
+);
+"""
+
+class Node():
+    __slots__ = ("addr", "node_id", "name", "path")
+
+    def __init__(self, addr: str, node_id: int, name: str, path: str) -> None:
+        self.addr = addr
+        self.node_id = node_id
+        self.name = name
+        self.path = path
+
+class Registry():
+
+    def __init__(self, path, send_logs_cb, hot_size=4096) -> None:
+        """
+        Stable id and document path of each node, by BLE address
+
+        The nodes are kept in the nodes table of the database, and all of them in memory
+        for the lookups. A new address keeps the path of the nodes added before the
+        registry, /doc/<last character of its name>, when it's free. Its id is that digit
+        (0 included) when it's free, or the next free id.
+
+        The hot state (last Device of each address) is only kept for the hot_size most
+        recently heard nodes.
+
+        Args:
+            path (str): The SQLite database file
+            send_logs_cb (function): Called with each log message
+            hot_size (int): Maximum number of Device kept in memory
+        """
+        self.__send_logs_cb = send_logs_cb
+        self.__hot_size = hot_size
+        self.__lock = Lock()
+
+        self.__db = sqlite3.connect(path, timeout=10, check_same_thread=False)
+        self.__db.execute("PRAGMA journal_mode=WAL")
+        self.__db.executescript(SCHEMA)
+
+        self.__nodes = {} # Node of each address
+        self.__paths = set()
+        self.__ids = set()
+        for row in self.__db.execute("SELECT addr, node_id, name, path FROM nodes"):
+            self.__add(Node(*row))
+        self.__next_id = max((node.node_id for node in self.__nodes.values()), default=0) + 1
+
+        self.__hot = OrderedDict() # Last Device of each address, least recently used first
+
+    def __len__(self) -> int:
+        return len(self.__nodes)
+
+    def __add(self, node: Node) -> None:
+        self.__nodes[node.addr] = node
+        self.__paths.add(node.path)
+        self.__ids.add(node.node_id)
+
+    def lookup(self, addr: str) -> Node:
+        '''Get the node of an address, None if it's not registered'''
+        return self.__nodes.get(addr)
+
+    def node(self, addr: str, name: str) -> Node:
+        '''Get the node of an address, registers it the first time'''
+        node = self.__nodes.get(addr)
+        if node is not None:
+            return node
+
+        with self.__lock:
+            node = self.__nodes.get(addr)
+            if node is not None:
+                return node
+
+            legacy = f"/doc/{name[-1]}" if name[-1:].isascii() and name[-1:].isalnum() else None # Path before the registry
+            if legacy in self.__paths:
+                legacy = None
+
+            node_id = int(name[-1]) if legacy is not None and name[-1].isdigit() else None
+            if node_id is None or node_id in self.__ids:
+                node_id = self.__next_id
+                while node_id in self.__ids or f"/doc/{node_id}" in self.__paths: # Taken by a provisioned node
+                    node_id += 1
+            self.__next_id = max(self.__next_id, node_id + 1)
+
+            node = Node(addr, node_id, name, legacy or f"/doc/{node_id}")
+            with self.__db:
+                self.__db.execute("INSERT INTO nodes VALUES (?, ?, ?, ?)", (node.addr, node.node_id, node.name, node.path))
+            self.__add(node)
+
+        self.__send_logs_cb(f"[Info] New node {name} ({addr}) registered as {node.path}")
+        return node
+
+    def get(self, addr: bytes):
+        '''Get the last Device of an address (as in the packets), None if it's not in the hot state'''
+        device = self.__hot.get(addr)
+        if device is not None:
+            self.__hot.move_to_end(addr)
+        return device
+
+    def devices(self) -> list:
+        '''Get the Device of the hot state'''
+        return list(self.__hot.values())
+
+    def put(self, addr: bytes, device) -> None:
+        '''Keep the last Device of an address, forgets the least recently used one when full'''
+        self.__hot[addr] = device
+        self.__hot.move_to_end(addr)
+        if len(self.__hot) > self.__hot_size:
+            self.__hot.popitem(last=False)
+
+    def provision(self, file) -> int:
+        """
+        Register or update the nodes of a CSV file, all of them or none
+
+        The file has a header with the columns addr, name and optionally node_id and path
+        (the next free id and /doc/<node_id> by default).
+
+        Args:
+            file (str): The CSV file
+
+        Returns:
+            int: The number of nodes of the file
+        """
+        with open(file, newline="") as f:
+            rows = list(csv.DictReader(f))
+
+        with self.__lock:
+            nodes = dict(self.__nodes)
+            next_id = self.__next_id
+            for line, row in enumerate(rows, start=2):
+                try:
+                    addr = row["addr"].strip().upper() # Like the data lines
+                    node_id = (row.get("node_id") or "").strip()
+                    node_id = int(node_id) if node_id else None # 0 is a valid id (/doc/0)
+                except (KeyError, AttributeError, ValueError):
+                    raise ValueError(f"{file}:{line}: invalid node {row}")
+
+                old = nodes.get(addr)
+                if node_id is None:
+                    node_id = old.node_id if old is not None else next_id
+                next_id = max(next_id, node_id + 1)
+                path = (row.get("path") or "").strip() or f"/doc/{node_id}"
+                nodes[addr] = Node(addr, node_id, (row.get("name") or "").strip() or (old.name if old else addr), path)
+
+            # The ids and paths must stay unique
+            for attr in ("node_id", "path"):
+                seen = {}
+                for node in nodes.values():
+                    other = seen.setdefault(getattr(node, attr), node)
+                    if other is not node:
+                        raise ValueError(f"{file}: {other.addr} and {node.addr} have the same {attr} {getattr(node, attr)}")
+
+            with self.__db:
+                self.__db.execute("DELETE FROM nodes")
+                self.__db.executemany("INSERT INTO nodes VALUES (?, ?, ?, ?)",
+                                      ((n.addr, n.node_id, n.name, n.path) for n in nodes.values()))
+
+            self.__nodes = {}
+            self.__paths = set()
+            self.__ids = set()
+            for node in nodes.values():
+                self.__add(node)
+            self.__next_id = next_id
+
+            for row in rows: # Their devices are created again with the new node
+                self.__hot.pop(row["addr"].strip().upper().encode(), None)
+
+        return len(rows)
+
+if __name__ == "__main__":
+    # python registry.py <database> <nodes.csv>
+    registry = Registry(sys.argv[1], print)
+    print(f"{registry.provision(sys.argv[2])} nodes provisioned, {len(registry)} registered")
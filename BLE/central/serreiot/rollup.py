@@ -0,0 +1,137 @@
+from threading import Thread, Lock
+from time import sleep, time
+
+# Length of the windows in seconds (1 min, 1 h, 1 day)
+RESOLUTIONS = (60, 3600, 86400)
+
+class Window():
+    '''Aggregates of one window, updated in O(1) for each sample'''
+    __slots__ = ("start", "min", "max", "sum", "count", "last")
+
+    def __init__(self, start: float, value: float) -> None:
+        self.start = start
+        self.min = value
+        self.max = value
+        self.sum = value
+        self.count = 1
+        self.last = value
+
+    def add(self, value: float) -> None:
+        if value < self.min:
+            self.min = value
+        if value > self.max:
+            self.max = value
+        self.sum += value
+        self.count += 1
+        self.last = value
+
+    def merge(self, value: float) -> None:
+        '''Add a late sample, older than the last one'''
+        if value < self.min:
+            self.min = value
+        if value > self.max:
+            self.max = value
+        self.sum += value
+        self.count += 1
+
+    @property
+    def mean(self) -> float:
+        return self.sum / self.count
+
+
+class Rollups():
+
+    def __init__(self, close_cb, resolutions=RESOLUTIONS, grace=5.0, sweep_interval=10.0) -> None:
+        """
+        Tumbling windows of each device and metric, at several resolutions
+
+        Args:
+            close_cb (function): Called with (addr, metric, resolution, window) when a window is closed
+            resolutions (tuple): The length of the windows in seconds
+            grace (float): Seconds waited after the end of a window before closing it without a newer sample
+            sweep_interval (float): Seconds between two checks of the windows without newer samples
+        """
+        self.__close_cb = close_cb
+        self.__resolutions = resolutions
+        self.__grace = grace
+        self.__sweep_interval = sweep_interval
+        self.__windows = {} # Open window of each (addr, metric, resolution)
+        self.__closed = {} # Last closed window of each (addr, metric, resolution)
+        self.__lock = Lock()
+
+        self.__sweep_thread = Thread(target=self.__sweep, daemon=True)
+        self.__sweep_thread.start()
+
+    def add(self, addr: str, ts: float, values: dict, late=False) -> list:
+        """
+        Add the values of a packet
+
+        A late sample is merged in its window without changing its last value. When it
+        belongs to the last closed window, this window is closed again with it (close_cb).
+        The older windows are no longer in memory, they are returned to be merged where
+        they are stored.
+
+        Args:
+            addr (str): The address of the device
+            ts (float): The time of the sample (seconds since the epoch)
+            values (dict): {value id: value}
+            late (bool): Older than a sample already added
+
+        Returns:
+            list: (metric, resolution, start) of the windows closed before the last one the sample belongs to
+        """
+        closed = []
+        missed = []
+        with self.__lock:
+            for metric, value in values.items():
+                for resolution in self.__resolutions:
+                    key = (addr, metric, resolution)
+                    start = ts - ts % resolution
+                    window = self.__windows.get(key)
+
+                    if window is not None and window.start == start:
+                        if late:
+                            window.merge(value)
+                        else:
+                            window.add(value)
+                        continue
+
+                    last_closed = self.__closed.get(key)
+                    if last_closed is not None and last_closed.start == start:
+                        last_closed.merge(value)
+                        closed.append((key, last_closed))
+                        continue
+
+                    if window is not None and window.start > start or last_closed is not None and start < last_closed.start:
+                        missed.append((metric, resolution, start))
+                        continue
+
+                    if window is not None:
+                        closed.append((key, window))
+                        self.__closed[key] = window
+                    self.__windows[key] = Window(start, value)
+
+        for (addr, metric, resolution), window in closed:
+            self.__close_cb(addr, metric, resolution, window)
+        return missed
+
+    def current(self, addr: str, metric: int, resolution: int) -> Window:
+        '''Get the open window of a device (None if there is none)'''
+        with self.__lock:
+            return self.__windows.get((addr, metric, resolution))
+
+    def __sweep(self) -> None:
+        '''Close the windows that ended without a newer sample'''
+        while True:
+            sleep(self.__sweep_interval)
+            now = time()
+
+            with self.__lock:
+                closed = [(key, window) for key, window in self.__windows.items()
+                          if now >= window.start + key[2] + self.__grace]
+                for key, window in closed:
+                    del self.__windows[key]
+                    self.__closed[key] = window
+
+            for (addr, metric, resolution), window in closed:
+                self.__close_cb(addr, metric, resolution, window)
@@ -0,0 +1,152 @@
+SEQ_MODULO = 256 # The counter of the broadcaster is 8 bits (service_data[3])
+WINDOW = 64 # Counters remembered behind the highest one
+MASK = (1 << WINDOW) - 1
+RESTART_MAX = 8 # A node counts again from 0 after a reboot, the first counters received are below this
+
+# Result of SequenceTracker.check
+NEW = 0 # Newer than the highest counter
+LATE = 1 # Missing counter received after a newer one
+DUPLICATE = 2 # Counter already received
+STALE = 3 # Too old to know
+REBOOT = 4 # The node started counting again
+RESYNC = 5 # Silent for too long to know how many counters were missed
+HELD = 6 # Maybe the first counter after a reboot, the next counter tells (kept by the caller until then)
+
+ACCEPTED = (NEW, REBOOT, RESYNC)
+
+class SequenceTracker():
+    __slots__ = ("highest", "bitmap", "span", "last_new", "period",
+                 "received", "late", "duplicates", "lost", "reboots", "resyncs", "reboot_min",
+                 "reboot_seq", "confirmed")
+
+    def __init__(self, reboot_min=5.0) -> None:
+        """
+        Sliding window of the counters of one node
+
+        The bit n of the bitmap is set when the counter highest - n was received.
+        Everything is modulo 256, a counter is newer when it's less than half the
+        counter space ahead. The counters missing when the window moves are lost,
+        unless they are received later.
+
+        A counter behind the highest one is a reboot (the node starts again at 0)
+        when nothing new was received for 2 periods (the copies of a counter only
+        last the advertising duration). A node can also reboot within 2 periods:
+        a counter far behind, a small counter received RESTART_MAX counters ago or
+        more, or a small counter ahead by more counters than the time since the
+        last one allows is HELD.
+        It's a reboot when the next counter follows it instead of the old ones,
+        then the held counter is received too (confirmed) and the counters skipped
+        by the reboot are not lost. Otherwise it was a stray copy and is dropped.
+
+        Args:
+            reboot_min (float): Minimum seconds without a new counter before an old counter is a reboot
+        """
+        self.highest = None
+        self.bitmap = 0
+        self.span = 0 # Number of valid bits
+        self.last_new = 0 # Time of the last new counter
+        self.period = None # Estimated seconds between two counters
+
+        self.received = 0
+        self.late = 0
+        self.duplicates = 0
+        self.lost = 0
+        self.reboots = 0
+        self.resyncs = 0
+        self.reboot_min = reboot_min
+        self.reboot_seq = None # Counter HELD, a reboot if the next one follows it
+        self.confirmed = False # The last REBOOT confirmed the counter held, it is received before this one
+
+    @property
+    def loss_rate(self) -> float:
+        '''Part of the counters lost'''
+        expected = self.received + self.lost
+        return self.lost / expected if expected else 0.0
+
+    def behind(self, seq: int) -> int:
+        '''Number of counters between a counter and the highest one (0 for the highest)'''
+        return (self.highest - seq) % SEQ_MODULO
+
+    def __restart(self, seq: int, now: float) -> None:
+        self.highest = seq
+        self.bitmap = 1
+        self.span = 1
+        self.last_new = now
+        self.received += 1
+        self.reboot_seq = None
+
+    def __restarted(self, seq: int, diff: int, elapsed: float) -> bool:
+        '''Check if a small counter ahead went past 255 sooner than the period allows (counting again from 0)'''
+        return seq < RESTART_MAX and seq < self.highest and self.period is not None and \
+            diff > 2 * elapsed / self.period + 2
+
+    def check(self, seq: int, now: float) -> int:
+        '''Take a counter, returns what it is (NEW, LATE, DUPLICATE, STALE, REBOOT, RESYNC or HELD)'''
+        self.confirmed = False
+        if self.highest is None:
+            self.__restart(seq, now)
+            return NEW
+
+        elapsed = now - self.last_new
+        period = self.period or self.reboot_min
+        reboot_gap = max(2 * period, self.reboot_min)
+
+        if self.period is not None and elapsed > period * SEQ_MODULO / 2: # The counter may have wrapped any number of times
+            self.resyncs += 1
+            self.__restart(seq, now)
+            return RESYNC
+
+        diff = (seq - self.highest) % SEQ_MODULO
+        back = (SEQ_MODULO - diff) % SEQ_MODULO
+        ahead = 0 < diff < SEQ_MODULO // 2 and not self.__restarted(seq, diff, elapsed)
+
+        if self.reboot_seq is not None:
+            held, self.reboot_seq = self.reboot_seq, None
+            if seq == held: # Another copy of it
+                self.reboot_seq = held
+                self.duplicates += 1
+                return DUPLICATE
+            step = (seq - held) % SEQ_MODULO
+            if 0 < step < WINDOW and not ahead: # Counting again from the held counter
+                self.reboots += 1
+                self.__restart(seq, now)
+                self.bitmap |= 1 << step
+                self.span = step + 1
+                self.received += 1
+                self.lost += step - 1
+                self.confirmed = True
+                return REBOOT
+            # A stray copy, this counter is checked against the old ones
+
+        if ahead: # The counters skipped are lost for now
+            sample = elapsed / diff
+            self.period = sample if self.period is None else self.period + (sample - self.period) / 8
+            self.bitmap = ((self.bitmap << diff) | 1) & MASK
+            self.span = min(WINDOW, self.span + diff)
+            self.highest = seq
+            self.last_new = now
+            self.received += 1
+            self.lost += diff - 1
+            return NEW
+
+        if elapsed > reboot_gap and (back > 0 or seq == 0):
+            self.reboots += 1
+            self.__restart(seq, now)
+            return REBOOT
+
+        if back >= WINDOW or (seq < RESTART_MAX <= back and (back >= self.span or self.bitmap >> back & 1)):
+            self.reboot_seq = seq
+            return HELD
+
+        if back >= self.span: # Before the first counter received
+            return STALE
+
+        if self.bitmap >> back & 1:
+            self.duplicates += 1
+            return DUPLICATE
+
+        self.bitmap |= 1 << back
+        self.received += 1
+        self.late += 1
+        self.lost -= 1
+        return LATE
@@ -0,0 +1,317 @@
+from threading import Thread
+from queue import Queue, Full, Empty
+from time import monotonic, sleep, strftime, localtime
+import json
+import os
+import socket
+import struct
+
+from payload import METRICS
+import metrics
+
+SINK_LATENCY = metrics.Histogram("serreiot_sink_seconds", "Duration of the writes of each sink", ("sink",))
+
+_sinks = [] # Every sink, for the metrics
+
+class NotApplied(Exception):
+    '''Raised by a callback that failed before any part of the record was applied, the record is tried again'''
+
+class Record():
+    '''One accepted sample, as given to every sink'''
+    __slots__ = ("node", "counter", "time", "values", "sampled_at", "late")
+
+    def __init__(self, node, counter: int, time: float, values: dict, sampled_at: float = None, late=False) -> None:
+        self.node = node # Node of the registry
+        self.counter = counter
+        self.time = time # Seconds since the epoch of the reading
+        self.values = values # {value id: value}
+        self.sampled_at = sampled_at # Host monotonic time of the reading (None if unknown)
+        self.late = late # Older than a record already given (not the latest values of the node)
+
+class Sink():
+
+    def __init__(self, name, send_logs_cb, queue_size=10000, batch_size=500, backoff_max=30.0, put_timeout=None) -> None:
+        """
+        Output of the records, with its own queue and worker thread
+
+        By default put never waits: a slow or broken sink can't stall the others or the
+        reader, its records are dropped once its queue is full. With put_timeout, put
+        waits for room while the sink is only slow (the reader is paused, like the uplink
+        handoff) and drops the record after the timeout. A failed write is retried
+        with the same records after a backoff (1 s doubled up to backoff_max).
+        The subclasses implement write.
+
+        Args:
+            name (str): The name of the sink in the logs and the metrics
+            send_logs_cb (function): Called with each log message
+            queue_size (int): Maximum number of records waiting
+            batch_size (int): Maximum number of records given to one write
+            backoff_max (float): Maximum seconds between two tries
+            put_timeout (float): Maximum seconds put waits for room in the queue (None never waits)
+        """
+        self.name = name
+        self._send_logs_cb = send_logs_cb
+        self.__batch_size = batch_size
+        self.__backoff_max = backoff_max
+        self.__put_timeout = put_timeout
+        self.__queue = Queue(queue_size)
+
+        self.written = 0
+        self.dropped = 0
+        self.errors = 0
+
+        self.__latency = SINK_LATENCY.labels(name)
+        _sinks.append(self)
+
+        self.__thread = Thread(target=self.__run, daemon=True)
+        self.__thread.start()
+
+    @property
+    def pending(self) -> int:
+        '''Number of records waiting'''
+        return self.__queue.qsize()
+
+    def put(self, record: Record) -> None:
+        '''Add a record, dropped if the queue is full (after put_timeout)'''
+        try:
+            if self.__put_timeout is None:
+                self.__queue.put_nowait(record)
+            else:
+                self.__queue.put(record, timeout=self.__put_timeout)
+        except Full:
+            self.dropped += 1
+            if self.dropped == 1 or self.dropped % 1000 == 0:
+                self._send_logs_cb(f"[Warning] Sink {self.name} behind, {self.dropped} records dropped")
+
+    def write(self, records: list) -> None:
+        '''Write records (raises on failure)'''
+        raise NotImplementedError
+
+    def __take(self) -> list:
+        '''Wait for the next records'''
+        records = [self.__queue.get()]
+        while len(records) < self.__batch_size:
+            try:
+                records.append(self.__queue.get_nowait())
+            except Empty:
+                break
+        return records
+
+    def __run(self) -> None:
+        while True:
+            records = self.__take()
+            backoff = 1.0
+            while True:
+                start = monotonic()
+                try:
+                    self.write(records)
+                except Exception as e:
+                    self.errors += 1
+                    self._send_logs_cb(f"[Error] Sink {self.name} failed to write {len(records)} records: {e}")
+                    sleep(backoff)
+                    backoff = min(backoff * 2, self.__backoff_max)
+                    continue
+                self.__latency.observe(monotonic() - start)
+                self.written += len(records)
+                break
+
+class CallbackSink(Sink):
+
+    def __init__(self, name, callback, send_logs_cb, **kwargs) -> None:
+        """
+        Sink that calls a function with each record (backend, local store)
+
+        A record is only tried again when the callback raises NotApplied. Any other
+        error may come after a part of it was applied (e.g. merged in the rollups), so
+        it's logged and dropped rather than applied twice.
+
+        Args:
+            name (str): The name of the sink
+            callback (function): Called with each Record (raises NotApplied when it can be tried again)
+            send_logs_cb (function): Called with each log message
+        """
+        self.__callback = callback
+        super().__init__(name, send_logs_cb, **kwargs)
+
+    def write(self, records: list) -> None:
+        failed = []
+        for i, record in enumerate(records):
+            try:
+                self.__callback(record)
+            except NotApplied:
+                del records[:i] # Only the records not written yet are tried again
+                raise
+            except Exception as e:
+                failed.append(record)
+                self.dropped += 1
+                self._send_logs_cb(f"[Error] Sink {self.name} dropped a record of {record.node.addr} "
+                                   f"(counter {record.counter}), maybe partly applied: {e}")
+        for record in failed: # Not counted as written
+            records.remove(record)
+
+class MqttSink(Sink):
+
+    def __init__(self, host, port, send_logs_cb, topic="serreiot", client_id="serreiot-gateway", retain=True,
+                 timeout=5.0, **kwargs) -> None:
+        """
+        Sink that publishes the records on an MQTT broker (MQTT 3.1.1, QoS 0)
+
+        Each record is published on <topic>/<node id> as JSON
+        {"node_id", "addr", "name", "counter", "time", "values": {metric name: value}}.
+        With retain, a new subscriber gets the latest record of each node at once
+        (the late records are never retained).
+
+        Args:
+            host (str): The address of the broker
+            port (int): The port of the broker (1883)
+            send_logs_cb (function): Called with each log message
+            topic (str): The prefix of the topics
+            client_id (str): The client identifier given to the broker
+            retain (bool): Ask the broker to keep the last record of each topic
+            timeout (float): Seconds to connect and to send
+        """
+        self.__address = (host, port)
+        self.__topic = topic
+        self.__client_id = client_id
+        self.__retain = retain
+        self.__timeout = timeout
+        self.__sock = None
+        super().__init__("mqtt", send_logs_cb, **kwargs)
+
+    @staticmethod
+    def _string(value: str) -> bytes:
+        data = value.encode()
+        return struct.pack("!H", len(data)) + data
+
+    @staticmethod
+    def _packet(header: int, body: bytes) -> bytes:
+        '''Fixed header (type and flags, remaining length) followed by the body'''
+        length = len(body)
+        encoded = bytearray()
+        while True:
+            byte = length % 128
+            length //= 128
+            encoded.append(byte | 0x80 if length else byte)
+            if not length:
+                break
+        return bytes([header]) + bytes(encoded) + body
+
+    def __connect(self) -> None:
+        sock = socket.create_connection(self.__address, self.__timeout)
+        try:
+            # CONNECT: protocol name, level 4, clean session, no keep alive (the broker never closes an idle client)
+            sock.sendall(self._packet(0x10, self._string("MQTT") + bytes([4, 0x02]) + struct.pack("!H", 0) +
+                                      self._string(self.__client_id)))
+            connack = b""
+            while len(connack) < 4:
+                chunk = sock.recv(4 - len(connack))
+                if not chunk:
+                    raise ConnectionError("closed by the broker")
+                connack += chunk
+            if connack[0] != 0x20 or connack[3] != 0:
+                raise ConnectionError(f"refused by the broker (code {connack[3]})")
+        except Exception:
+            sock.close()
+            raise
+        self.__sock = sock
+        self._send_logs_cb(f"[Info] Connected to the MQTT broker {self.__address[0]}:{self.__address[1]}")
+
+    def write(self, records: list) -> None:
+        if self.__sock is None:
+            self.__connect()
+
+        data = bytearray()
+        for record in records:
+            header = 0x31 if self.__retain and not record.late else 0x30 # PUBLISH, QoS 0
+            node = record.node
+            payload = json.dumps({
+                "node_id": node.node_id,
+                "addr": node.addr,
+                "name": node.name,
+                "counter": record.counter,
+                "time": round(record.time, 3),
+                "values": {METRICS.get(value_id, str(value_id)): value for value_id, value in record.values.items()},
+            }, separators=(",", ":")).encode()
+            data += self._packet(header, self._string(f"{self.__topic}/{node.node_id}") + payload)
+
+        try:
+            self.__sock.sendall(data)
+        except OSError:
+            self.__sock.close()
+            self.__sock = None
+            raise
+
+class CsvSink(Sink):
+
+    def __init__(self, path, send_logs_cb, max_bytes=10_000_000, backup_count=10, **kwargs) -> None:
+        """
+        Sink that writes the records in a rotating CSV file
+
+        One line per record: date, node id, address, counter, then one column per metric.
+        When the file is over max_bytes it's renamed path.1 (path.1 becomes path.2, ...)
+        and a new file is started with the header.
+
+        Args:
+            path (str): The CSV file
+            send_logs_cb (function): Called with each log message
+            max_bytes (int): Size of the file before it's rotated
+            backup_count (int): Number of rotated files kept
+        """
+        self.__path = path
+        self.__max_bytes = max_bytes
+        self.__backup_count = backup_count
+        self.__columns = tuple(METRICS)
+        self.__header = ",".join(("date", "time", "node_id", "addr", "counter") +
+                                 tuple(METRICS[value_id] for value_id in self.__columns)) + "\n"
+        self.__file = None
+        super().__init__("csv", send_logs_cb, **kwargs)
+
+    def __open(self) -> None:
+        self.__file = open(self.__path, "a", encoding="utf-8")
+        if self.__file.tell() == 0:
+            self.__file.write(self.__header)
+
+    def __rotate(self) -> None:
+        self.__file.close()
+        self.__file = None
+        for i in range(self.__backup_count - 1, 0, -1):
+            if os.path.exists(f"{self.__path}.{i}"):
+                os.replace(f"{self.__path}.{i}", f"{self.__path}.{i + 1}")
+        if self.__backup_count > 0:
+            os.replace(self.__path, f"{self.__path}.1")
+        else:
+            os.remove(self.__path)
+
+    def write(self, records: list) -> None:
+        if self.__file is None:
+            self.__open()
+
+        lines = []
+        for record in records:
+            values = record.values
+            lines.append(",".join([
+                strftime("%Y-%m-%d %H:%M:%S", localtime(record.time)),
+                f"{record.time:.3f}",
+                str(record.node.node_id),
+                record.node.addr,
+                str(record.counter),
+            ] + ["" if values.get(value_id) is None else f"{values[value_id]:g}" for value_id in self.__columns]) + "\n")
+
+        self.__file.write("".join(lines))
+        self.__file.flush()
+
+        if self.__file.tell() >= self.__max_bytes:
+            self.__rotate()
+
+def _collect() -> list:
+    '''Values of the metrics endpoint'''
+    sinks = list(_sinks)
+    per_sink = lambda attr: [({"sink": sink.name}, getattr(sink, attr)) for sink in sinks]
+    return [
+        ("serreiot_sink_queue", "gauge", "Records waiting in each sink", per_sink("pending")),
+        ("serreiot_sink_written_total", "counter", "Records written by each sink", per_sink("written")),
+        ("serreiot_sink_dropped_total", "counter", "Records dropped because the queue of the sink was full", per_sink("dropped")),
+        ("serreiot_sink_errors_total", "counter", "Failed writes of each sink", per_sink("errors")),
+    ]
+
+metrics.collector(_collect)
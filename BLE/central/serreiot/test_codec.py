@@ -0,0 +1,58 @@
+import math
+import unittest
+
+from codec import encode_block, decode_block, HEADER, MODE_DELTA, MODE_XOR
+
+
+def grid(count: int, period=600_000, start=1_700_000_000_000) -> list:
+    '''Timestamps of a node sending every period, with a little jitter'''
+    return [start + i * period + (i * 37) % 250 for i in range(count)]
+
+
+class CodecTest(unittest.TestCase):
+
+    def test_hundredths_round_trip(self):
+        timestamps = grid(1000)
+        values = [round(20 + 5 * math.sin(i / 50), 2) for i in range(1000)]
+        data = encode_block(timestamps, values)
+
+        self.assertEqual(data[0], MODE_DELTA)
+        self.assertEqual(decode_block(data), (timestamps, values)) # The same floats, not only close
+        self.assertLess(len(data), 3 * len(values)) # A few bits for each timestamp and value
+
+    def test_floats_round_trip(self):
+        timestamps = grid(200)
+        values = [20 + math.sin(i) / 3 for i in range(200)] # Don't fit hundredths
+        data = encode_block(timestamps, values)
+
+        self.assertEqual(data[0], MODE_XOR)
+        self.assertEqual(decode_block(data), (timestamps, values))
+
+    def test_edge_values(self):
+        for values in ([0.0], [-40.0, -39.99, 125.0, -0.01], [1e300, -1e-300, 0.0, 3.0], [1e14, -1e14 + 0.01], [math.inf, -math.inf, 3.0]):
+            timestamps = grid(len(values))
+            self.assertEqual(decode_block(encode_block(timestamps, values)), (timestamps, values))
+
+        decoded = decode_block(encode_block([0, 1], [math.nan, 1.0]))[1]
+        self.assertTrue(math.isnan(decoded[0]))
+        self.assertEqual(decoded[1], 1.0)
+
+    def test_irregular_timestamps(self):
+        timestamps = [0, 1, 2, 10_000, 10_001, 2**40, 2**40 + 5, 2**41] # Gaps and reboots of the node
+        values = [float(i) for i in range(len(timestamps))]
+        self.assertEqual(decode_block(encode_block(timestamps, values)), (timestamps, values))
+
+    def test_single_sample(self):
+        data = encode_block([5000], [21.5])
+        self.assertEqual(len(data), HEADER.size)
+        self.assertEqual(decode_block(data), ([5000], [21.5]))
+
+    def test_invalid_block(self):
+        with self.assertRaises(ValueError):
+            encode_block([], [])
+        with self.assertRaises(ValueError):
+            encode_block([1, 2], [1.0])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,57 @@
+import unittest
+
+from dedup import Deduplicator, EARLIEST, BEST_RSSI
+
+
+class EarliestTest(unittest.TestCase):
+
+    def test_first_copy_sent(self):
+        dedup = Deduplicator(window=2.0, policy=EARLIEST)
+        self.assertEqual(dedup.offer(("a", 1), -80, "dongle 0", 10.0), "dongle 0")
+        self.assertIsNone(dedup.offer(("a", 1), -40, "dongle 1", 10.05)) # Better but too late
+        self.assertEqual(dedup.offer(("a", 2), -80, "next", 10.1), "next")
+        self.assertEqual(dedup.offer(("b", 1), -80, "other node", 10.1), "other node")
+        self.assertIsNone(dedup.next_deadline())
+
+    def test_key_forgotten_after_window(self):
+        dedup = Deduplicator(window=2.0, policy=EARLIEST)
+        dedup.offer(("a", 1), -80, "first", 10.0)
+        self.assertIsNone(dedup.offer(("a", 1), -80, "copy", 11.99))
+        self.assertEqual(dedup.offer(("a", 1), -80, "counter wrapped", 12.0), "counter wrapped")
+        dedup.offer(("a", 2), -80, "x", 20.0)
+        self.assertEqual(len(dedup), 1) # Only the recent keys are kept
+
+
+class BestRssiTest(unittest.TestCase):
+
+    def test_best_copy_sent_after_hold(self):
+        dedup = Deduplicator(window=2.0, policy=BEST_RSSI, hold=0.1)
+        self.assertIsNone(dedup.offer(("a", 1), -80, "far", 10.0))
+        self.assertIsNone(dedup.offer(("a", 1), -50, "near", 10.03))
+        self.assertIsNone(dedup.offer(("a", 1), -70, "middle", 10.06))
+        self.assertEqual(dedup.next_deadline(), 10.1)
+        self.assertEqual(dedup.due(10.09), [])
+        self.assertEqual(dedup.due(10.1), ["near"])
+        self.assertIsNone(dedup.next_deadline())
+
+        self.assertIsNone(dedup.offer(("a", 1), -30, "after the hold", 10.2)) # Already sent
+        self.assertEqual(dedup.due(11.0), [])
+
+    def test_unknown_rssi(self):
+        dedup = Deduplicator(policy=BEST_RSSI, hold=0.1)
+        dedup.offer(("a", 1), None, "no rssi", 0.0)
+        dedup.offer(("a", 1), None, "no rssi either", 0.01)
+        dedup.offer(("a", 1), -90, "weak", 0.02)
+        self.assertEqual(dedup.due(0.1), ["weak"])
+
+    def test_due_in_arrival_order(self):
+        dedup = Deduplicator(policy=BEST_RSSI, hold=0.1)
+        dedup.offer(("a", 1), -80, "a1", 0.0)
+        dedup.offer(("b", 7), -80, "b7", 0.05)
+        dedup.offer(("a", 2), -80, "a2", 0.08)
+        self.assertEqual(dedup.due(0.16), ["a1", "b7"])
+        self.assertEqual(dedup.due(1.0), ["a2"])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,92 @@
+import json
+import os
+import tempfile
+import threading
+import time
+import unittest
+
+from outbox import Outbox
+
+
+class Backend():
+    '''Keeps the last value of each path, rejects the paths given and fails while offline'''
+
+    def __init__(self, rejected=(), offline=0) -> None:
+        self.doc = {}
+        self.rejected = set(rejected)
+        self.offline = offline # Calls that fail with a connection error
+        self.lock = threading.Lock()
+
+    def update_doc(self, fields: dict) -> None:
+        with self.lock:
+            if self.offline:
+                self.offline -= 1
+                raise ConnectionError("offline")
+            if self.rejected & set(fields):
+                raise ValueError("bad path")
+            self.doc.update(fields)
+
+
+def wait(condition, timeout=5.0) -> bool:
+    '''Wait until condition() is true'''
+    deadline = time.monotonic() + timeout
+    while not condition():
+        if time.monotonic() > deadline:
+            return False
+        time.sleep(0.01)
+    return True
+
+
+class OutboxTest(unittest.TestCase):
+
+    def setUp(self):
+        self.folder = tempfile.TemporaryDirectory()
+        self.logs = []
+
+    def tearDown(self):
+        self.folder.cleanup()
+
+    def outbox(self, backend: Backend, **kwargs) -> Outbox:
+        return Outbox(self.folder.name, backend.update_doc, self.logs.append, backoff_min=0.01, backoff_max=0.02,
+                      sync_interval=0.01, workers=1, **kwargs)
+
+    def test_rejected_path_does_not_stall(self):
+        backend = Backend(rejected={"/doc/1/bad"})
+        outbox = self.outbox(backend, max_tries=3)
+        outbox.put({"/doc/1/temperature": 21.5, "/doc/1/bad": 1})
+        for i in range(20):
+            outbox.put({f"/doc/{i}/id": i})
+
+        self.assertTrue(wait(lambda: outbox.pending_bytes == 0))
+        self.assertEqual(backend.doc["/doc/1/temperature"], 21.5) # Sent alone
+        self.assertEqual(backend.doc["/doc/19/id"], 19)
+        self.assertNotIn("/doc/1/bad", backend.doc)
+        self.assertEqual(outbox.dead, 1)
+        with open(os.path.join(self.folder.name, "dead.jsonl")) as f:
+            self.assertEqual(json.loads(f.readline())["update"], {"/doc/1/bad": 1})
+
+    def test_outage_is_retried(self):
+        backend = Backend(offline=10)
+        outbox = self.outbox(backend, max_tries=2)
+        outbox.put({"/doc/0/id": 1})
+
+        self.assertTrue(wait(lambda: outbox.pending_bytes == 0))
+        self.assertEqual(backend.doc, {"/doc/0/id": 1}) # Not a rejection, never dropped
+        self.assertEqual(outbox.dead, 0)
+
+    def test_torn_line(self):
+        with open(os.path.join(self.folder.name, "00000001.jsonl"), "wb") as f:
+            f.write(b'{"/doc/0/id":1}\n{"/doc/0/id":2}\n{"/doc/0/i') # Crash during the write of the third one
+
+        backend = Backend()
+        outbox = self.outbox(backend)
+        self.assertEqual(outbox.dropped, 1)
+        outbox.put({"/doc/0/temperature": 20.0}) # Appended after the last complete line
+
+        self.assertTrue(wait(lambda: outbox.pending_bytes == 0))
+        self.assertEqual(backend.doc, {"/doc/0/id": 2, "/doc/0/temperature": 20.0})
+        self.assertEqual(outbox.sent, 3)
+
+
+if __name__ == '__main__':
+    unittest.main()
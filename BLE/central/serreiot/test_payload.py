@@ -0,0 +1,39 @@
+import unittest
+
+from payload import encode_payload, decode_layout, PAIR, HEADER, SCALES, TEMPERATURE_ID, HUMIDITY_ID
+
+
+def pair(value: float) -> tuple:
+    '''Whole and decimal parts of a value encoded alone'''
+    _, whole, decimal = PAIR.unpack(encode_payload(0, {TEMPERATURE_ID: value})[HEADER.size:])
+    return whole, decimal
+
+
+class EncodePayloadTest(unittest.TestCase):
+
+    def test_carry(self):
+        self.assertEqual(pair(2.999), (3, 0))
+        self.assertEqual(pair(2.994), (2, 99))
+        self.assertEqual(pair(99.999), (100, 0))
+
+    def test_same_as_broadcaster(self):
+        # Outputs of payload_encode_pair (lroundf, then floor division)
+        self.assertEqual(pair(3.07), (3, 7))
+        self.assertEqual(pair(3.3), (3, 30))
+        self.assertEqual(pair(0.125), (0, 13)) # Half away from zero
+        self.assertEqual(pair(-0.125), (255, 87))
+        self.assertEqual(pair(-1.5), (254, 50))
+
+    def test_round_trip(self):
+        values = {metric: 0.0 for metric in SCALES}
+        for hundredths in range(0, 25600, 7):
+            values[TEMPERATURE_ID] = hundredths / 100
+            values[HUMIDITY_ID] = (25599 - hundredths) / 100
+            _, _, counter, decoded = decode_layout(encode_payload(hundredths, values))
+            self.assertEqual(counter, hundredths & 0xff)
+            self.assertEqual(decoded[TEMPERATURE_ID], hundredths / 100) # The same float, not only close
+            self.assertEqual(decoded[HUMIDITY_ID], (25599 - hundredths) / 100)
+
+
+if __name__ == '__main__':
+    unittest.main()
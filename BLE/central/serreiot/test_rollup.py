@@ -0,0 +1,54 @@
+import unittest
+
+from rollup import Rollups
+
+T0 = 1_700_000_040.0 # Start of a 1 min window
+
+
+class RollupsTest(unittest.TestCase):
+
+    def setUp(self):
+        self.closed = []
+        self.rollups = Rollups(lambda addr, metric, resolution, window: self.closed.append(
+                               (resolution, window.start, window.count, window.min, window.max, window.last)),
+                               resolutions=(60,), sweep_interval=3600) # Never sweeps during the test
+
+    def test_late_sample_in_open_window(self):
+        self.rollups.add("a", T0 + 10, {1: 20.0})
+        self.rollups.add("a", T0 + 30, {1: 22.0})
+        self.rollups.add("a", T0 + 20, {1: 18.0}, late=True)
+
+        window = self.rollups.current("a", 1, 60)
+        self.assertEqual((window.count, window.min, window.max, window.sum), (3, 18.0, 22.0, 60.0))
+        self.assertEqual(window.last, 22.0) # Still the newest sample
+        self.assertEqual(self.closed, [])
+
+    def test_late_sample_closes_again(self):
+        self.rollups.add("a", T0 + 10, {1: 20.0})
+        self.rollups.add("a", T0 + 70, {1: 21.0}) # Closes the first window
+        self.assertEqual(self.closed, [(60, T0, 1, 20.0, 20.0, 20.0)])
+
+        self.assertEqual(self.rollups.add("a", T0 + 50, {1: 25.0}, late=True), [])
+        self.assertEqual(self.closed[1], (60, T0, 2, 20.0, 25.0, 20.0)) # Same window, written again
+        self.assertEqual(self.rollups.current("a", 1, 60).count, 1)
+
+    def test_older_window_missed(self):
+        self.rollups.add("a", T0 + 10, {1: 20.0, 2: 50.0})
+        self.rollups.add("a", T0 + 70, {1: 21.0, 2: 51.0})
+        self.rollups.add("a", T0 + 130, {1: 22.0, 2: 52.0})
+
+        missed = self.rollups.add("a", T0 - 30, {1: 19.0, 2: 49.0}, late=True) # Only in the store
+        self.assertEqual(sorted(missed), [(1, 60, T0 - 60), (2, 60, T0 - 60)])
+        self.assertEqual(len(self.closed), 4) # Nothing closed again
+
+    def test_devices_apart(self):
+        self.rollups.add("a", T0 + 10, {1: 20.0})
+        self.rollups.add("b", T0 + 70, {1: 30.0})
+        self.rollups.add("a", T0 + 20, {1: 10.0}, late=True)
+        self.assertEqual(self.rollups.current("a", 1, 60).min, 10.0)
+        self.assertEqual(self.rollups.current("b", 1, 60).min, 30.0)
+        self.assertEqual(self.closed, [])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,90 @@
+import unittest
+
+from sequence import SequenceTracker, NEW, LATE, DUPLICATE, STALE, REBOOT, HELD
+
+PERIOD = 600.0 # Seconds between two counters of a node
+
+
+def running(highest: int) -> tuple:
+    '''Tracker of a node that sent the counters 0 to highest, one per period, and the time of the last one'''
+    tracker = SequenceTracker()
+    for seq in range(highest + 1):
+        assert tracker.check(seq, seq * PERIOD) == NEW
+    return tracker, highest * PERIOD
+
+
+class FastRebootTest(unittest.TestCase):
+    '''A node that restarts at 0 within 2 periods of its last counter'''
+
+    def check_reboot(self, highest: int) -> None:
+        tracker, now = running(highest)
+        lost = tracker.lost
+
+        self.assertEqual(tracker.check(0, now + PERIOD / 2), HELD)
+        self.assertEqual(tracker.check(0, now + PERIOD / 2 + 1), DUPLICATE) # A copy of the held counter
+        self.assertEqual(tracker.check(1, now + 1.5 * PERIOD), REBOOT)
+        self.assertTrue(tracker.confirmed)
+        self.assertEqual(tracker.highest, 1)
+        self.assertEqual(tracker.lost, lost) # The counters skipped by the reboot are not lost
+        self.assertEqual(tracker.reboots, 1)
+        self.assertEqual(tracker.check(0, now + 1.5 * PERIOD + 1), DUPLICATE) # Received when confirmed
+        self.assertEqual(tracker.check(2, now + 2.5 * PERIOD), NEW)
+
+    def test_highest_in_window(self):
+        self.check_reboot(10) # 0 and 1 are in the window, already received
+
+    def test_highest_far_behind(self):
+        self.check_reboot(100) # 0 is more than a window behind
+
+    def test_highest_half_ahead(self):
+        self.check_reboot(200) # 0 is less than 128 counters ahead
+
+    def test_reboot_skipping_a_counter(self):
+        tracker, now = running(100)
+        self.assertEqual(tracker.check(0, now + PERIOD / 2), HELD)
+        self.assertEqual(tracker.check(2, now + 2.5 * PERIOD), REBOOT)
+        self.assertEqual(tracker.lost, 1) # Only counter 1
+        self.assertEqual(tracker.check(1, now + 2.5 * PERIOD + 1), LATE)
+
+
+class SequenceTest(unittest.TestCase):
+
+    def test_wrap(self):
+        tracker, now = running(255)
+        self.assertEqual(tracker.check(0, now + PERIOD), NEW)
+        self.assertEqual(tracker.check(3, now + 4 * PERIOD), NEW) # Wrapped and lost 2 counters
+        self.assertEqual(tracker.lost, 2)
+        self.assertEqual(tracker.reboots, 0)
+
+    def test_stray_counter(self):
+        tracker, now = running(99)
+        self.assertEqual(tracker.check(30, now + 1), HELD)
+        self.assertEqual(tracker.check(100, now + PERIOD), NEW) # The old counters go on, it was a stray copy
+        self.assertFalse(tracker.confirmed)
+        self.assertEqual(tracker.reboots, 0)
+        self.assertEqual(tracker.lost, 0)
+
+    def test_late_and_duplicate(self):
+        tracker, now = running(20)
+        self.assertEqual(tracker.check(23, now + 3 * PERIOD), NEW)
+        self.assertEqual(tracker.lost, 2)
+        self.assertEqual(tracker.check(21, now + 3 * PERIOD + 1), LATE)
+        self.assertEqual(tracker.check(21, now + 3 * PERIOD + 2), DUPLICATE)
+        self.assertEqual(tracker.lost, 1)
+
+    def test_reboot_after_silence(self):
+        tracker, now = running(40)
+        self.assertEqual(tracker.check(0, now + 3 * PERIOD), REBOOT)
+        self.assertFalse(tracker.confirmed)
+
+    def test_stale(self):
+        tracker, now = running(100)
+        self.assertEqual(tracker.check(90, now + 1), DUPLICATE)
+        tracker = SequenceTracker()
+        tracker.check(50, 0)
+        tracker.check(51, PERIOD)
+        self.assertEqual(tracker.check(40, PERIOD + 1), STALE) # Before the first counter received
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,95 @@
+import threading
+import time
+import unittest
+
+from sinks import Record, NotApplied, CallbackSink, Sink
+
+
+class Node():
+    addr = "F0:CA:F0:CA:00:01"
+
+
+def record(counter: int) -> Record:
+    return Record(Node(), counter, 1000.0 + counter, {1: 20.0})
+
+
+def wait(condition, timeout=5.0) -> bool:
+    '''Wait until condition() is true'''
+    deadline = time.monotonic() + timeout
+    while not condition():
+        if time.monotonic() > deadline:
+            return False
+        time.sleep(0.01)
+    return True
+
+
+class CallbackSinkTest(unittest.TestCase):
+
+    def test_not_applied_is_tried_again(self):
+        applied = []
+        failures = [1]
+
+        def callback(record):
+            if record.counter == 2 and failures:
+                failures.pop()
+                raise NotApplied("database locked")
+            applied.append(record.counter)
+
+        sink = CallbackSink("test", callback, lambda msg: None)
+        for counter in range(4):
+            sink.put(record(counter))
+
+        self.assertTrue(wait(lambda: len(applied) == 4))
+        self.assertEqual(applied, [0, 1, 2, 3]) # Once each, in order
+        self.assertEqual(sink.errors, 1)
+
+    def test_partly_applied_is_dropped(self):
+        applied = []
+
+        def callback(record):
+            applied.append(record.counter)
+            if record.counter == 1:
+                raise RuntimeError("failed after the rollups")
+
+        sink = CallbackSink("test", callback, lambda msg: None)
+        for counter in range(3):
+            sink.put(record(counter))
+
+        self.assertTrue(wait(lambda: sink.written == 2))
+        self.assertEqual(applied, [0, 1, 2]) # Never applied twice
+        self.assertEqual(sink.dropped, 1)
+
+
+class SlowSink(Sink):
+
+    def __init__(self, **kwargs) -> None:
+        self.release = threading.Event()
+        super().__init__("slow", lambda msg: None, batch_size=1, **kwargs)
+
+    def write(self, records: list) -> None:
+        self.release.wait()
+
+
+class PutTimeoutTest(unittest.TestCase):
+
+    def test_waits_for_room(self):
+        sink = SlowSink(queue_size=1, put_timeout=5.0)
+        sink.put(record(0)) # Taken by the worker, blocked in write
+        self.assertTrue(wait(lambda: sink.pending == 0))
+        sink.put(record(1)) # Fills the queue
+        threading.Timer(0.1, sink.release.set).start()
+        sink.put(record(2)) # Waits until the worker takes the next one
+        self.assertEqual(sink.dropped, 0)
+
+    def test_drops_without_timeout(self):
+        sink = SlowSink(queue_size=1)
+        sink.put(record(0))
+        self.assertTrue(wait(lambda: sink.pending == 0))
+        sink.put(record(1))
+        sink.put(record(2))
+        self.assertEqual(sink.dropped, 1)
+        sink.release.set()
+
+
+if __name__ == '__main__':
+    unittest.main()
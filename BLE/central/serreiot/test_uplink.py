@@ -0,0 +1,64 @@
+import threading
+import time
+import unittest
+
+from uplink import UplinkBatcher
+
+
+class Sent():
+    '''Batches given to send_cb'''
+
+    def __init__(self) -> None:
+        self.batches = []
+        self.event = threading.Event()
+
+    def send(self, batch: dict) -> None:
+        self.batches.append(dict(batch))
+        self.event.set()
+
+    def wait(self, count: int, timeout=2.0) -> bool:
+        '''Wait until count batches were sent'''
+        deadline = time.monotonic() + timeout
+        while len(self.batches) < count and time.monotonic() < deadline:
+            time.sleep(0.005)
+        return len(self.batches) >= count
+
+
+class UplinkBatcherTest(unittest.TestCase):
+
+    def test_flush_during_window(self):
+        sent = Sent()
+        uplink = UplinkBatcher(sent.send, print, window=0.2)
+        uplink.update({"/doc/0/id": 1})
+        time.sleep(0.05) # The worker waits for the end of the window
+        uplink.flush()
+        uplink.update({"/doc/0/id": 2}) # The worker must still be alive
+
+        self.assertTrue(sent.wait(2))
+        self.assertEqual(sent.batches, [{"/doc/0/id": 1}, {"/doc/0/id": 2}])
+
+    def test_same_value_skipped(self):
+        sent = Sent()
+        uplink = UplinkBatcher(sent.send, print, window=0.01)
+        uplink.update({"/doc/0/id": 1, "/doc/0/temperature": 20.5})
+        self.assertTrue(sent.wait(1))
+        uplink.update({"/doc/0/id": 2, "/doc/0/temperature": 20.5})
+        self.assertTrue(sent.wait(2))
+        self.assertEqual(sent.batches[1], {"/doc/0/id": 2})
+
+    def test_dropped_value_sent_again(self):
+        sent = Sent()
+        uplink = UplinkBatcher(sent.send, print, window=0.01)
+        uplink.update({"/doc/0/temperature": 20.5})
+        self.assertTrue(sent.wait(1))
+        uplink.forget(["/doc/0/temperature"]) # Dropped by the outbox
+        uplink.update({"/doc/0/temperature": 20.5})
+        self.assertTrue(sent.wait(2))
+        uplink.forget()
+        uplink.update({"/doc/0/temperature": 20.5})
+        self.assertTrue(sent.wait(3))
+        self.assertEqual(sent.batches, [{"/doc/0/temperature": 20.5}] * 3)
+
+
+if __name__ == '__main__':
+    unittest.main()
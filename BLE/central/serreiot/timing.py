@@ -0,0 +1,88 @@
+from threading import Lock
+from time import monotonic, time
+
+import metrics
+
+# Seconds, from a fresh sample (~1 s old) up to an outbox that waited for the backend
+AGE_BUCKETS = (0.1, 0.5, 1.0, 2.0, 5.0, 10.0, 30.0, 60.0, 300.0, 1800.0, 3600.0)
+
+STAGE_LATENCY = metrics.Histogram("serreiot_stage_seconds", "Time spent in each stage of the pipeline", ("stage",))
+SAMPLE_AGE = metrics.Histogram("serreiot_sample_age_seconds", "Age of the samples when they reach a point of the pipeline",
+                               ("point",), AGE_BUCKETS)
+
+def wall_time(sampled_at: float) -> float:
+    '''Get the seconds since the epoch of a host monotonic time (now if None)'''
+    now = time()
+    return now if sampled_at is None else now - (monotonic() - sampled_at)
+
+class ClockOffset():
+    __slots__ = ("window", "current", "current_start", "previous", "last_uptime")
+
+    def __init__(self, window=60.0) -> None:
+        """
+        Difference between the clock of the host (monotonic) and the uptime of a dongle
+
+        Each %time frame gives the offset plus the delay of the frame (buffer, USB,
+        reading), so the smallest offset is kept. It's the smallest of the current and
+        the previous windows, so the drift of the clocks is followed.
+
+        Args:
+            window (float): Seconds of a window
+        """
+        self.window = window
+        self.current = None # Smallest offset of the current window
+        self.current_start = 0
+        self.previous = None # Smallest offset of the previous window
+        self.last_uptime = None
+
+    def sample(self, uptime: float, now: float) -> None:
+        '''Take the uptime of the dongle (seconds) read at now (host monotonic time)'''
+        if self.last_uptime is not None and uptime < self.last_uptime: # The dongle restarted
+            self.current = self.previous = None
+        self.last_uptime = uptime
+
+        offset = now - uptime
+        if self.current is None or now - self.current_start > self.window:
+            self.previous = self.current
+            self.current = offset
+            self.current_start = now
+        elif offset < self.current:
+            self.current = offset
+
+    def to_host(self, uptime: float) -> float:
+        '''Get the host monotonic time of an uptime of the dongle, None before the first %time frame'''
+        if self.current is None:
+            return None
+        offset = self.current if self.previous is None else min(self.current, self.previous)
+        return uptime + offset
+
+class AckTracer():
+
+    def __init__(self) -> None:
+        """
+        Time of the samples sent upstream, until the backend accepts them
+
+        The sample of a device is known by the value of its id path (the counter), a
+        newer sample of the same device replaces it.
+        """
+        self.__pending = {} # (counter, time of the sample, time of send_data) of each id path
+        self.__lock = Lock()
+        self.__uplink_latency = STAGE_LATENCY.labels("uplink") # send_data -> accepted by the backend
+        self.__acked_age = SAMPLE_AGE.labels("acked")
+
+    def sent(self, path: str, counter: int, sampled_at: float) -> None:
+        '''A sample was given to the uplink (path of its id, its counter and its host monotonic time)'''
+        with self.__lock:
+            self.__pending[path] = (counter, sampled_at, monotonic())
+
+    def acked(self, fields: dict) -> None:
+        '''The backend accepted an update'''
+        now = monotonic()
+        with self.__lock:
+            for path, value in fields.items():
+                entry = self.__pending.get(path)
+                if entry is None or entry[0] != value:
+                    continue
+                del self.__pending[path]
+                self.__uplink_latency.observe(now - entry[2])
+                self.__acked_age.observe(now - entry[1])
@@ -0,0 +1,420 @@
+from threading import Thread, Lock, local
+from queue import Queue, Empty
+from time import monotonic, time
+import sqlite3
+
+from codec import encode_block, decode_block
+import metrics
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS devices (
+    id INTEGER PRIMARY KEY,
+    addr TEXT NOT NULL UNIQUE
+);
+CREATE TABLE IF NOT EXISTS samples (
+    device INTEGER NOT NULL,
+    metric INTEGER NOT NULL,
+    ts INTEGER NOT NULL, -- milliseconds since the epoch
+    value REAL NOT NULL,
+    PRIMARY KEY (device, metric, ts)
+) WITHOUT ROWID;
+-- Older samples, compressed by blocks (see codec.py)
+CREATE TABLE IF NOT EXISTS blocks (
+    device INTEGER NOT NULL,
+    metric INTEGER NOT NULL,
+    t_start INTEGER NOT NULL,
+    t_end INTEGER NOT NULL,
+    v_min REAL NOT NULL,
+    v_max REAL NOT NULL,
+    count INTEGER NOT NULL,
+    data BLOB NOT NULL
+);
+CREATE INDEX IF NOT EXISTS blocks_range ON blocks (device, metric, t_end);
+-- Closed aggregation windows (see rollup.py)
+CREATE TABLE IF NOT EXISTS rollups (
+    device INTEGER NOT NULL,
+    metric INTEGER NOT NULL,
+    resolution INTEGER NOT NULL, -- seconds
+    start INTEGER NOT NULL, -- milliseconds since the epoch
+    min REAL NOT NULL,
+    max REAL NOT NULL,
+    sum REAL NOT NULL,
+    count INTEGER NOT NULL,
+    last REAL NOT NULL,
+    PRIMARY KEY (device, metric, resolution, start)
+) WITHOUT ROWID;
+"""
+
+# Kind of the items of the write queue
+SAMPLES = 0
+ROLLUP = 1
+LATE_SAMPLES = 2
+MAINTENANCE = 3
+
+class TimeSeriesStore():
+
+    def __init__(self, path, send_logs_cb, batch_size=1000, flush_interval=1.0, retention_days=365,
+                 compact_after_hours=24, block_size=1024, duplicate_tolerance=5.0) -> None:
+        """
+        Local store of every reading, written in batches by a background thread
+
+        Args:
+            path (str): The SQLite database file
+            send_logs_cb (function): Called with each log message
+            batch_size (int): Maximum number of packets written in one transaction
+            flush_interval (float): Maximum seconds a packet waits before being written
+            retention_days (float): Samples older than this are deleted (None keeps everything)
+            compact_after_hours (float): Samples older than this are compressed in blocks (None never compresses)
+            block_size (int): Maximum number of samples in a block
+            duplicate_tolerance (float): Seconds around a late sample where the same value is already stored
+                when it was received before (less than half the period of the nodes)
+        """
+        self.__path = path
+        self.__send_logs_cb = send_logs_cb
+        self.__batch_size = batch_size
+        self.__flush_interval = flush_interval
+        self.__retention_ms = None if retention_days is None else int(retention_days * 86400 * 1000)
+        self.__compact_after_ms = None if compact_after_hours is None else int(compact_after_hours * 3600 * 1000)
+        self.__block_size = block_size
+        self.__tolerance_ms = int(duplicate_tolerance * 1000)
+        self.__duplicates = 0 # Late samples already stored
+        self.__pending_late = {} # (ts, value) of the late samples not written yet, for each (addr, metric)
+        self.__pending_lock = Lock()
+
+        self.__queue = Queue()
+        self.__local = local() # One connection per thread
+        self.__device_ids = {}
+
+        db = self._db()
+        db.execute("PRAGMA journal_mode=WAL")
+        db.executescript(SCHEMA)
+        self.__device_ids = dict(db.execute("SELECT addr, id FROM devices"))
+
+        self.__writer_thread = Thread(target=self.__writer, daemon=True)
+        self.__writer_thread.start()
+
+        metrics.collector(lambda: [
+            ("serreiot_store_queue", "gauge", "Readings waiting to be written in the store", [({}, self.__queue.qsize())]),
+            ("serreiot_store_duplicates_total", "counter", "Late samples already stored", [({}, self.__duplicates)]),
+        ])
+
+    def _db(self) -> sqlite3.Connection:
+        '''Get the connection of the current thread'''
+        db = getattr(self.__local, "db", None)
+        if db is None:
+            db = sqlite3.connect(self.__path)
+            db.execute("PRAGMA synchronous=NORMAL") # Safe with WAL, only the last transactions can be lost on power loss
+            self.__local.db = db
+        return db
+
+    def new_values(self, addr: str, ts: float, values: dict) -> dict:
+        """
+        Drop the values of a late sample that are already stored (a copy received again)
+
+        A value is a copy when the same value is stored within duplicate_tolerance of its
+        time, or is a late value kept by an earlier call and not written yet. The values
+        kept are expected to be given to append at once, before they're merged anywhere
+        else, so a copy is never counted twice. Nothing is kept when it raises (a database
+        error), so the sample can be checked again.
+
+        Args:
+            addr (str): The address of the device
+            ts (float): The time of the sample (seconds since the epoch)
+            values (dict): {value id: value}
+
+        Returns:
+            dict: {value id: value} of the values not stored yet
+        """
+        ts_ms = int(ts * 1000)
+        device_id = self.__device_ids.get(addr)
+        new = {}
+        with self.__pending_lock:
+            copies = 0
+            for metric, value in values.items():
+                pending = self.__pending_late.get((addr, metric), ())
+                if any(abs(ts_ms - other_ts) <= self.__tolerance_ms and other == value for other_ts, other in pending) or \
+                        device_id is not None and self.__stored(self._db(), device_id, metric, ts_ms, value):
+                    copies += 1
+                    continue
+                new[metric] = value
+
+            self.__duplicates += copies
+            for metric, value in new.items(): # Once every value is checked
+                self.__pending_late.setdefault((addr, metric), []).append((ts_ms, value))
+        return new
+
+    def append(self, addr: str, ts: float, values: dict, late=False, merge=()) -> None:
+        """
+        Add the values of a packet, never blocks
+
+        A late sample (received after newer ones, or sent again by its node) is also
+        merged in the closed windows of merge (the stored aggregates are updated in place).
+        Its copies must be dropped first with new_values.
+
+        Args:
+            addr (str): The address of the device
+            ts (float): The time of the sample (seconds since the epoch)
+            values (dict): {value id: value}
+            late (bool): Older than a sample already added
+            merge (list): (metric, resolution, start in seconds) of the stored windows the late sample belongs to
+        """
+        if late:
+            self.__queue.put((LATE_SAMPLES, addr, int(ts * 1000), values, merge))
+        else:
+            self.__queue.put((SAMPLES, addr, int(ts * 1000), values))
+
+    def append_rollup(self, addr: str, metric: int, resolution: int, start: float, window) -> None:
+        """
+        Add a closed aggregation window, never blocks
+
+        Args:
+            addr (str): The address of the device
+            metric (int): The value id
+            resolution (int): The length of the window in seconds
+            start (float): The start of the window (seconds since the epoch)
+            window (Window): The aggregates (min, max, sum, count, last)
+        """
+        self.__queue.put((ROLLUP, addr, metric, resolution, int(start * 1000),
+                          window.min, window.max, window.sum, window.count, window.last))
+
+    def maintain(self) -> None:
+        '''Purge and compact with the next batch, never blocks (done every hour anyway)'''
+        self.__queue.put((MAINTENANCE,))
+
+    def join(self) -> None:
+        '''Wait until every item added is written'''
+        self.__queue.join()
+
+    def query(self, addr: str, metric: int, start: float, end: float = None,
+              min_value: float = None, max_value: float = None) -> list:
+        """
+        Get the samples of a device in a time range
+
+        Args:
+            addr (str): The address of the device
+            metric (int): The value id
+            start (float): Start of the range (seconds since the epoch, included)
+            end (float): End of the range (excluded), now if None
+            min_value (float): Only the values greater or equal (the blocks out of range are skipped)
+            max_value (float): Only the values lower or equal
+
+        Returns:
+            list: (time in seconds, value) ordered by time
+        """
+        device_id = self.__device_ids.get(addr)
+        if device_id is None:
+            return []
+
+        start_ms = int(start * 1000)
+        end_ms = int((time() if end is None else end) * 1000)
+        low = float("-inf") if min_value is None else min_value
+        high = float("inf") if max_value is None else max_value
+        db = self._db()
+        samples = {}
+
+        blocks = db.execute(
+            "SELECT data FROM blocks WHERE device = ? AND metric = ? AND t_end >= ? AND t_start < ? "
+            "AND v_max >= ? AND v_min <= ?",
+            (device_id, metric, start_ms, end_ms, low, high))
+        for (data,) in blocks:
+            timestamps, values = decode_block(data)
+            for ts, value in zip(timestamps, values):
+                if start_ms <= ts < end_ms and low <= value <= high:
+                    samples[ts] = value
+
+        rows = db.execute(
+            "SELECT ts, value FROM samples WHERE device = ? AND metric = ? AND ts >= ? AND ts < ? "
+            "AND value >= ? AND value <= ?",
+            (device_id, metric, start_ms, end_ms, low, high))
+        samples.update(rows) # A sample stored again after its block was made wins
+
+        return [(ts / 1000, samples[ts]) for ts in sorted(samples)]
+
+    def query_rollups(self, addr: str, metric: int, resolution: int, start: float, end: float = None) -> list:
+        """
+        Get the closed windows of a device in a time range
+
+        Args:
+            addr (str): The address of the device
+            metric (int): The value id
+            resolution (int): The length of the windows in seconds
+            start (float): Start of the range (seconds since the epoch, included)
+            end (float): End of the range (excluded), now if None
+
+        Returns:
+            list: (start in seconds, min, max, mean, count, last) ordered by time
+        """
+        device_id = self.__device_ids.get(addr)
+        if device_id is None:
+            return []
+
+        end_ms = int((time() if end is None else end) * 1000)
+        rows = self._db().execute(
+            "SELECT start, min, max, sum, count, last FROM rollups "
+            "WHERE device = ? AND metric = ? AND resolution = ? AND start >= ? AND start < ? ORDER BY start",
+            (device_id, metric, resolution, int(start * 1000), end_ms))
+        return [(start_ms / 1000, low, high, total / count, count, last)
+                for start_ms, low, high, total, count, last in rows]
+
+    def last(self, addr: str, metric: int, seconds: float) -> list:
+        '''Get the samples of the last seconds (e.g. last(addr, 1, 86400) for the last 24 h)'''
+        return self.query(addr, metric, time() - seconds)
+
+    def __device_id(self, db: sqlite3.Connection, addr: str) -> int:
+        '''Get the id of a device, added if new (writer thread only)'''
+        device_id = self.__device_ids.get(addr)
+        if device_id is None:
+            device_id = db.execute("INSERT INTO devices (addr) VALUES (?)", (addr,)).lastrowid
+            self.__device_ids[addr] = device_id
+        return device_id
+
+    def __insert(self, db: sqlite3.Connection, samples: list, rollups: list) -> None:
+        '''Write the rows gathered and clear them'''
+        db.executemany("INSERT OR REPLACE INTO samples (device, metric, ts, value) VALUES (?, ?, ?, ?)", samples)
+        if rollups:
+            db.executemany("INSERT OR REPLACE INTO rollups (device, metric, resolution, start, min, max, sum, count, last) "
+                           "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", rollups)
+        samples.clear()
+        rollups.clear()
+
+    def __write(self, db: sqlite3.Connection, batch: list) -> None:
+        '''Write a batch of items in one transaction'''
+        samples = []
+        rollups = []
+        for item in batch:
+            if item[0] == MAINTENANCE:
+                continue
+            device_id = self.__device_id(db, item[1])
+            if item[0] == SAMPLES:
+                _, _, ts_ms, values = item
+                samples.extend((device_id, metric, ts_ms, value) for metric, value in values.items())
+            elif item[0] == LATE_SAMPLES:
+                self.__insert(db, samples, rollups) # In order, a window closed earlier in the batch is merged after it's written
+                self.__write_late(db, device_id, *item[2:])
+            else:
+                rollups.append((device_id, *item[2:]))
+
+        self.__insert(db, samples, rollups)
+
+    def __stored(self, db: sqlite3.Connection, device_id: int, metric: int, ts_ms: int, value: float) -> bool:
+        '''Check if the same value is stored within the tolerance of a time (only the blocks around it are read)'''
+        low, high = ts_ms - self.__tolerance_ms, ts_ms + self.__tolerance_ms
+        if db.execute("SELECT 1 FROM samples WHERE device = ? AND metric = ? AND ts BETWEEN ? AND ? AND value = ? LIMIT 1",
+                      (device_id, metric, low, high, value)).fetchone() is not None:
+            return True
+
+        blocks = db.execute(
+            "SELECT data FROM blocks WHERE device = ? AND metric = ? AND t_end >= ? AND t_start <= ? "
+            "AND v_min <= ? AND v_max >= ?",
+            (device_id, metric, low, high, value, value))
+        for (data,) in blocks:
+            timestamps, values = decode_block(data)
+            if any(low <= ts <= high and stored == value for ts, stored in zip(timestamps, values)):
+                return True
+        return False
+
+    def __write_late(self, db: sqlite3.Connection, device_id: int, ts_ms: int, new: dict, merge) -> None:
+        '''Write a late sample (without its copies, see new_values) and merge it in its stored windows'''
+        db.executemany("INSERT OR REPLACE INTO samples (device, metric, ts, value) VALUES (?, ?, ?, ?)",
+                       ((device_id, metric, ts_ms, value) for metric, value in new.items()))
+        db.executemany(
+            "INSERT INTO rollups (device, metric, resolution, start, min, max, sum, count, last) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, 1, ?) "
+            "ON CONFLICT (device, metric, resolution, start) DO UPDATE SET "
+            "min = min(rollups.min, excluded.min), max = max(rollups.max, excluded.max), "
+            "sum = rollups.sum + excluded.sum, count = rollups.count + 1",
+            ((device_id, metric, resolution, int(start * 1000), new[metric], new[metric], new[metric], new[metric])
+             for metric, resolution, start in merge if metric in new))
+
+    def __forget_late(self, batch: list) -> None:
+        '''Drop the late samples of a batch from the ones not written yet, once committed'''
+        with self.__pending_lock:
+            for item in batch:
+                if item[0] != LATE_SAMPLES:
+                    continue
+                _, addr, ts_ms, values, _ = item
+                for metric, value in values.items():
+                    pending = self.__pending_late.get((addr, metric))
+                    if pending is not None and (ts_ms, value) in pending:
+                        pending.remove((ts_ms, value))
+                        if not pending:
+                            del self.__pending_late[(addr, metric)]
+
+    def __purge(self, db: sqlite3.Connection) -> None:
+        '''Delete the samples older than the retention'''
+        if self.__retention_ms is not None:
+            cutoff = int(time() * 1000) - self.__retention_ms
+            db.execute("DELETE FROM samples WHERE ts < ?", (cutoff,))
+            db.execute("DELETE FROM blocks WHERE t_end < ?", (cutoff,))
+            db.execute("DELETE FROM rollups WHERE start < ?", (cutoff,))
+
+    def __compact(self, db: sqlite3.Connection) -> None:
+        """
+        Move the samples older than compact_after_hours into compressed blocks
+
+        A compaction only finds the samples of the last hour of each series (6 at a
+        10 minutes period), not enough to make up for the header of a block. They are
+        added to the last block of their series while it's not full, so the blocks
+        hold block_size samples and only the newest one of a series is partial.
+        """
+        if self.__compact_after_ms is None:
+            return
+
+        cutoff = int(time() * 1000) - self.__compact_after_ms
+        rows = db.execute("SELECT device, metric, ts, value FROM samples WHERE ts < ? ORDER BY device, metric, ts",
+                          (cutoff,))
+        series = {}
+        for device_id, metric, ts, value in rows:
+            series.setdefault((device_id, metric), {})[ts] = value
+
+        blocks = []
+        for (device_id, metric), samples in series.items():
+            partial = db.execute(
+                "SELECT rowid, data FROM blocks WHERE device = ? AND metric = ? AND count < ? ORDER BY t_end DESC LIMIT 1",
+                (device_id, metric, self.__block_size)).fetchone()
+            if partial is not None: # Decoded again with the new samples, the ones stored since win
+                rowid, data = partial
+                timestamps, values = decode_block(data)
+                samples = {**dict(zip(timestamps, values)), **samples}
+                db.execute("DELETE FROM blocks WHERE rowid = ?", (rowid,))
+
+            timestamps = sorted(samples)
+            for i in range(0, len(timestamps), self.__block_size):
+                ts = timestamps[i:i + self.__block_size]
+                blocks.append((device_id, metric, ts, [samples[t] for t in ts]))
+
+        db.executemany(
+            "INSERT INTO blocks (device, metric, t_start, t_end, v_min, v_max, count, data) VALUES (?, ?, ?, ?, ?, ?, ?, ?)",
+            ((device_id, metric, ts[0], ts[-1], min(vals), max(vals), len(ts), encode_block(ts, vals))
+             for device_id, metric, ts, vals in blocks))
+        db.execute("DELETE FROM samples WHERE ts < ?", (cutoff,))
+
+    def __writer(self) -> None:
+        '''Write the items in batches'''
+        db = self._db()
+        next_purge = monotonic()
+
+        while True:
+            batch = [self.__queue.get()] # Wait for the first item
+            deadline = monotonic() + self.__flush_interval
+
+            while len(batch) < self.__batch_size:
+                try:
+                    batch.append(self.__queue.get(timeout=max(0, deadline - monotonic())))
+                except Empty:
+                    break
+
+            try:
+                with db: # One transaction
+                    self.__write(db, batch)
+                    if monotonic() >= next_purge or any(item[0] == MAINTENANCE for item in batch):
+                        self.__purge(db)
+                        self.__compact(db)
+                        next_purge = monotonic() + 3600
+            except sqlite3.Error as e:
+                self.__send_logs_cb(f"[Error] Unable to store {len(batch)} items: {e}")
+                self.__device_ids = dict(db.execute("SELECT addr, id FROM devices")) # Forget the ids rolled back
+
+            self.__forget_late(batch)
+            for _ in batch:
+                self.__queue.task_done()
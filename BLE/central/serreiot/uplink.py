@@ -0,0 +1,115 @@
+from threading import Thread, Condition
+from time import monotonic
+
+import metrics
+
+class UplinkBatcher():
+
+    def __init__(self, send_cb, send_logs_cb, window=2.0, max_size=500) -> None:
+        """
+        Gather the document updates of all the devices and send them together
+
+        A value is skipped when it's the last one given to send_cb for its path. send_cb
+        only queues it (outbox), so the ones the outbox drops must be forgotten (forget).
+
+        Args:
+            send_cb (function): Called with a dict {path: value}, sends it to the backend (raises on failure)
+            send_logs_cb (function): Called with each log message
+            window (float): Seconds waited after the first pending update before sending
+            max_size (int): Number of pending paths that triggers a send before the end of the window
+        """
+        self.__send_cb = send_cb
+        self.__send_logs_cb = send_logs_cb
+        self.__window = window
+        self.__max_size = max_size
+
+        self.__pending = {} # Paths not sent yet
+        self.__queued = {} # Last value given to send_cb for each path (queued, not yet accepted by the backend)
+        self.__first_update = None # Time of the oldest pending update
+        self.__cond = Condition()
+
+        self.__thread = Thread(target=self.__run, daemon=True)
+        self.__thread.start()
+
+        metrics.collector(lambda: [
+            ("serreiot_uplink_pending_paths", "gauge", "Paths waiting for the next batch", [({}, len(self.__pending))]),
+        ])
+
+    def update(self, fields: dict) -> None:
+        '''Add updates to the next batch, the values already queued are skipped'''
+        with self.__cond:
+            for path, value in fields.items():
+                if self.__queued.get(path) == value:
+                    self.__pending.pop(path, None) # Back to the queued value
+                    continue
+                self.__pending[path] = value
+
+            if not self.__pending:
+                return
+
+            if self.__first_update is None:
+                self.__first_update = monotonic()
+                self.__cond.notify()
+            elif len(self.__pending) >= self.__max_size:
+                self.__cond.notify()
+
+    def forget(self, paths=None) -> None:
+        '''Forget the values queued for paths (all of them when None) because they were dropped, they are sent again'''
+        with self.__cond:
+            if paths is None:
+                self.__queued.clear()
+            else:
+                for path in paths:
+                    self.__queued.pop(path, None)
+
+    def flush(self) -> None:
+        '''Send the pending updates now'''
+        with self.__cond:
+            batch = self.__take()
+        self.__send(batch)
+
+    def __take(self) -> dict:
+        '''Take the pending updates (the condition lock must be held)'''
+        batch = self.__pending
+        self.__pending = {}
+        self.__first_update = None
+        return batch
+
+    def __send(self, batch: dict) -> None:
+        '''Send a batch, put it back in the pending updates if it fails'''
+        if not batch:
+            return
+
+        try:
+            self.__send_cb(batch)
+        except Exception as e:
+            self.__send_logs_cb(f"[Error] Unable to send {len(batch)} updates: {e}")
+            with self.__cond:
+                batch.update(self.__pending) # Newer values win
+                self.__pending = batch
+                if self.__first_update is None:
+                    self.__first_update = monotonic()
+            return
+
+        with self.__cond:
+            self.__queued.update(batch)
+
+    def __run(self) -> None:
+        '''Send the pending updates at the end of each window'''
+        while True:
+            with self.__cond:
+                while self.__first_update is None:
+                    self.__cond.wait()
+
+                # Wait for the end of the window, unless the batch is already full
+                while self.__first_update is not None and len(self.__pending) < self.__max_size:
+                    remaining = self.__first_update + self.__window - monotonic()
+                    if remaining <= 0:
+                        break
+                    self.__cond.wait(remaining)
+
+                if self.__first_update is None: # Sent by flush() during the window
+                    continue
+                batch = self.__take()
+
+            self.__send(batch)
@@ -0,0 +1,299 @@
+"""
+Generator of the advertising payload code, from payload.json
+
+The layout of the service data is only described in payload.json. This script
+writes the encoder of the broadcaster (a packed C struct with static asserts on
+its size and offsets) and the decoder of the gateway (a precompiled struct and
+a decoding function without loops). Both files are committed: the header is
+a reference copy next to the schema, the broadcaster build generates its own in
+the build directory.
+
+Usage: python payload/gen_payload.py                 write both files
+       python payload/gen_payload.py --check         fail if a file is not up to date
+       python payload/gen_payload.py --c <file>      only write the C header (used by CMake)
+"""
+import argparse
+import json
+import os
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SCHEMA = os.path.join(HERE, 'payload.json')
+C_HEADER = os.path.join(HERE, 'payload.h')
+PYTHON_MODULE = os.path.join(HERE, '..', 'central', 'serreiot', 'payload.py')
+
+HEADER_SIZE = 4 # Service UUID, format version, counter
+PAIR_SIZE = 3 # Value id, whole part, decimal part
+MAX_SIZE = 254 # Largest AD structure of an extended advertising
+
+
+def load(path: str) -> dict:
+    '''Read and check the schema'''
+    with open(path, encoding='utf-8') as f:
+        schema = json.load(f)
+
+    uuid = bytes.fromhex(schema['service_uuid'])
+    if len(uuid) != 2:
+        raise ValueError('service_uuid must be 2 bytes (16-bit UUID)')
+    if not 0 <= schema['version'] <= 255:
+        raise ValueError('version must fit in a byte')
+
+    ids, names = set(), set()
+    for field in schema['fields']:
+        field.setdefault('scale', schema.get('scale', 100))
+        field.setdefault('age', False)
+        if not field['name'].isidentifier():
+            raise ValueError(f'{field["name"]} is not a valid name')
+        if not 0 < field['id'] <= 255 or field['id'] in ids or field['name'] in names:
+            raise ValueError(f'{field["name"]}: the ids and the names must be unique, the ids from 1 to 255')
+        if not 0 < field['scale'] <= 256:
+            raise ValueError(f'{field["name"]}: the decimal part of the scale must fit in a byte')
+        if field['age'] == ('member' in field):
+            raise ValueError(f'{field["name"]}: a value has a member of sensors_data_t, the age has none')
+        ids.add(field['id'])
+        names.add(field['name'])
+
+    if sum(field['age'] for field in schema['fields']) > 1:
+        raise ValueError('Only one age field')
+    if HEADER_SIZE + PAIR_SIZE * len(schema['fields']) > MAX_SIZE:
+        raise ValueError('The payload is too long')
+    return schema
+
+
+def c_header(schema: dict) -> str:
+    '''Encoder of the broadcaster'''
+    fields = schema['fields']
+    uuid = bytes.fromhex(schema['service_uuid'])
+    size = HEADER_SIZE + PAIR_SIZE * len(fields)
+    lines = [
+        '/**',
+        ' * payload.h',
+        ' * ',
+        ' * Layout and encoder of the service data',
+        ' * ',
+        ' * Generated by BLE/payload/gen_payload.py from BLE/payload/payload.json, do not edit.',
+        ' * ',
+        '*/',
+        '',
+        '#ifndef PAYLOAD_H_',
+        '#define PAYLOAD_H_',
+        '',
+        '#include <math.h>',
+        '#include <stddef.h>',
+        '#include <stdint.h>',
+        '#include <zephyr/toolchain.h>',
+        '#include "utils.h" /* broadcaster/src, in the include path */',
+        '',
+        f'#define SERVICE_UUID_1 0x{uuid[0]:02x}',
+        f'#define SERVICE_UUID_2 0x{uuid[1]:02x}',
+        f'#define PAYLOAD_FORMAT_VERSION {schema["version"]}',
+        '',
+    ]
+    lines += [f'#define {field["name"].upper()}_ID {field["id"]} /* {field["description"]} */' for field in fields]
+    lines += [f'#define {field["name"].upper()}_MAX {field["max"]}f' for field in fields if 'max' in field]
+    lines += [
+        '',
+        '/* Value id, whole part, decimal part (1 / scale) */',
+        'struct payload_pair {',
+        '    uint8_t id;',
+        '    uint8_t whole;',
+        '    uint8_t decimal;',
+        '} __packed;',
+        '',
+        'struct payload {',
+        '    uint8_t uuid[2];',
+        '    uint8_t version;',
+        '    uint8_t counter;',
+    ]
+    lines += [f'    struct payload_pair {field["name"]};' for field in fields]
+    lines += [
+        '} __packed;',
+        '',
+        'BUILD_ASSERT(sizeof(struct payload_pair) == 3, "A pair is 3 bytes");',
+        f'BUILD_ASSERT(sizeof(struct payload) == {size}, "The payload is {size} bytes");',
+    ]
+    lines += [f'BUILD_ASSERT(offsetof(struct payload, {field["name"]}) == {HEADER_SIZE + PAIR_SIZE * i}, '
+              f'"Wrong position of {field["name"]}");' for i, field in enumerate(fields)]
+    lines += [
+        '',
+        '/**',
+        ' * @brief Encode a value into a pair',
+        ' * ',
+        ' * Rounded to 1 / scale then split, like encode_payload of the gateway (2.999 is 3.00).',
+        ' * ',
+        ' * @param pair pair of the payload',
+        ' * @param id id of the value',
+        ' * @param val value to encode',
+        ' * @param scale the decimal part is in 1 / scale',
+        '*/',
+        'static inline void payload_encode_pair(struct payload_pair *pair, uint8_t id, float val, uint16_t scale) {',
+        '    long n = lroundf(val * scale);',
+        '    long whole = n / scale;',
+        '    long decimal = n % scale;',
+        '',
+        '    if (decimal < 0) { /* Floor division, like divmod */',
+        '        decimal += scale;',
+        '        whole -= 1;',
+        '    }',
+        '    pair->id = id;',
+        '    pair->whole = (uint8_t)whole;',
+        '    pair->decimal = (uint8_t)decimal;',
+        '}',
+        '',
+        '/**',
+        ' * @brief Set the service UUID and the format version',
+        ' * ',
+        ' * @param payload payload to initialize',
+        '*/',
+        'static inline void payload_init(struct payload *payload) {',
+        '    payload->uuid[0] = SERVICE_UUID_1;',
+        '    payload->uuid[1] = SERVICE_UUID_2;',
+        '    payload->version = PAYLOAD_FORMAT_VERSION;',
+        '}',
+        '',
+        '/**',
+        ' * @brief Encode the counter and the values of a reading',
+        ' * ',
+        ' * @param payload payload to encode into',
+        ' * @param counter advertising counter',
+        ' * @param data values of the reading',
+        '*/',
+        'static inline void payload_encode(struct payload *payload, uint8_t counter, const sensors_data_t *data) {',
+        '    payload->counter = counter;',
+    ]
+    lines += [f'    payload_encode_pair(&payload->{field["name"]}, {field["name"].upper()}_ID, data->{field["member"]}, '
+              f'{field["scale"]});' for field in fields if not field['age']]
+    lines.append('}')
+    for field in fields:
+        if not field['age']:
+            continue
+        name = field['name']
+        lines += [
+            '',
+            '/**',
+            f' * @brief Encode the {name.replace("_", " ")}',
+            ' * ',
+            ' * @param payload payload to encode into',
+            ' * @param val seconds since the reading' + (f' (capped at {field["max"]})' if 'max' in field else ''),
+            '*/',
+            f'static inline void payload_encode_{name}(struct payload *payload, float val) {{',
+        ]
+        if 'max' in field:
+            lines += [
+                f'    if (val > {name.upper()}_MAX) {{',
+                f'        val = {name.upper()}_MAX;',
+                '    }',
+            ]
+        lines += [
+            f'    payload_encode_pair(&payload->{name}, {name.upper()}_ID, val, {field["scale"]});',
+            '}',
+        ]
+    lines += ['', '#endif /* PAYLOAD_H_ */', '']
+    return '\n'.join(lines)
+
+
+def python_module(schema: dict) -> str:
+    '''Decoder of the gateway'''
+    fields = schema['fields']
+    values = [field for field in fields if not field['age']]
+    age = next((field for field in fields if field['age']), None)
+    default_scale = schema.get('scale', 100)
+    uuid = ''.join(f'\\x{b:02x}' for b in bytes.fromhex(schema['service_uuid']))
+    lines = [
+        '# Layout of the service data',
+        '# Generated by BLE/payload/gen_payload.py from BLE/payload/payload.json, do not edit.',
+        'from struct import Struct',
+        '',
+        f'SERVICE_UUID = b"{uuid}"',
+        f'FORMAT_VERSION = {schema["version"]}',
+        f'DEFAULT_SCALE = {default_scale} # The decimal part of a pair is in 1 / scale',
+        '',
+        'HEADER = Struct("2sBB") # Service UUID, format version, counter',
+        'PAIR = Struct("BBB") # Value id, whole part, decimal part',
+        '',
+    ]
+    lines += [f'{field["name"].upper()}_ID = {field["id"]} # {field["description"]}' for field in fields]
+    lines += [
+        '',
+        '# Name of each value id',
+        'METRICS = {',
+    ]
+    lines += [f'    {field["id"]}: "{field["name"]}",' for field in values]
+    lines += [
+        '}',
+        '',
+        '# Scale of each value id',
+        'SCALES = {',
+    ]
+    lines += [f'    {field["id"]}: {field["scale"]},' for field in fields]
+    lines += [
+        '}',
+        '',
+        f'# Layout sent by the broadcaster: header followed by {len(fields)} pairs',
+        f'LAYOUT = Struct(HEADER.format + PAIR.format * {len(fields)})',
+    ]
+    if age is not None:
+        lines.append(f'AGE_ID = {age["name"].upper()}_ID # Pair with the age of the reading (seconds), not a value')
+    lines += [
+        '',
+        '',
+        'def decode_layout(data: bytes) -> tuple:',
+        '    \'\'\'Decode a payload of LAYOUT.size bytes: (uuid, version, counter, {value id: value})\'\'\'',
+        '    (uuid, version, counter,',
+    ]
+    for i in range(len(fields)):
+        end = ') = LAYOUT.unpack(data)' if i == len(fields) - 1 else ','
+        lines.append(f'     id{i}, whole{i}, decimal{i}{end}')
+    lines.append('    return uuid, version, counter, {')
+    # Same float as round(value * scale) / scale, so the stored values compress as deltas (see codec.py)
+    lines += [f'        id{i}: (whole{i} * {field["scale"]} + decimal{i}) / {field["scale"]},' for i, field in enumerate(fields)]
+    lines += [
+        '    }',
+        '',
+        '',
+        'def encode_payload(counter: int, values: dict) -> bytes:',
+        '    \'\'\'Encode a payload with the pairs of values ({value id: value}, in this order), for the tools and tests\'\'\'',
+        '    data = bytearray(HEADER.pack(SERVICE_UUID, FORMAT_VERSION, counter & 0xff))',
+        '    for value_id, value in values.items():',
+        '        scale = SCALES.get(value_id, DEFAULT_SCALE)',
+        '        n = value * scale',
+        '        n = int(n + 0.5) if n >= 0 else -int(0.5 - n) # Half away from zero, like lroundf of the broadcaster',
+        '        whole, decimal = divmod(n, scale) # 2.999 carries into 3.00',
+        '        data += PAIR.pack(value_id, whole & 0xff, decimal)',
+        '    return bytes(data)',
+        '',
+    ]
+    return '\n'.join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate the payload encoder and decoder from payload.json')
+    parser.add_argument('--schema', default=SCHEMA)
+    parser.add_argument('--c', help='Only write the C header to this file')
+    parser.add_argument('--check', action='store_true', help='Fail if a generated file is not up to date')
+    args = parser.parse_args()
+
+    schema = load(args.schema)
+    outputs = [(args.c, c_header(schema))] if args.c else [(C_HEADER, c_header(schema)), (PYTHON_MODULE, python_module(schema))]
+
+    stale = []
+    for path, content in outputs:
+        current = None
+        if os.path.exists(path):
+            with open(path, encoding='utf-8') as f:
+                current = f.read()
+        if current == content:
+            continue
+        if args.check:
+            stale.append(os.path.relpath(path))
+            continue
+        with open(path, 'w', encoding='utf-8', newline='\n') as f: # Only written when it changes, for the builds
+            f.write(content)
+        print(f'Generated {os.path.relpath(path)}')
+
+    if stale:
+        sys.exit(f'Not up to date (run payload/gen_payload.py): {", ".join(stale)}')
+
+
+if __name__ == '__main__':
+    main()
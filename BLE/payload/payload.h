@@ -0,0 +1,127 @@
+/**
+ * payload.h
+ * 
+ * Layout and encoder of the service data
+ * 
+ * Generated by BLE/payload/gen_payload.py from BLE/payload/payload.json, do not edit.
+ * 
+*/
+
+#ifndef PAYLOAD_H_
+#define PAYLOAD_H_
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+#include "utils.h" /* broadcaster/src, in the include path */
+
+#define SERVICE_UUID_1 0xab
+#define SERVICE_UUID_2 0xcd
+#define PAYLOAD_FORMAT_VERSION 0
+
+#define TEMPERATURE_ID 1 /* Air temperature (AHT20) */
+#define HUMIDITY_ID 2 /* Air humidity (AHT20) */
+#define LUMINOSITE_ID 3 /* Luminosity (PT19) */
+#define GND_TEMPERATURE_ID 4 /* Ground temperature */
+#define GND_HUMIDITY_ID 5 /* Ground humidity */
+#define BATTERIE_ID 254 /* Battery voltage */
+#define SAMPLE_AGE_ID 253 /* Seconds since the reading, updated while advertising */
+#define SAMPLE_AGE_MAX 255.99f
+
+/* Value id, whole part, decimal part (1 / scale) */
+struct payload_pair {
+    uint8_t id;
+    uint8_t whole;
+    uint8_t decimal;
+} __packed;
+
+struct payload {
+    uint8_t uuid[2];
+    uint8_t version;
+    uint8_t counter;
+    struct payload_pair temperature;
+    struct payload_pair humidity;
+    struct payload_pair luminosite;
+    struct payload_pair gnd_temperature;
+    struct payload_pair gnd_humidity;
+    struct payload_pair batterie;
+    struct payload_pair sample_age;
+} __packed;
+
+BUILD_ASSERT(sizeof(struct payload_pair) == 3, "A pair is 3 bytes");
+BUILD_ASSERT(sizeof(struct payload) == 25, "The payload is 25 bytes");
+BUILD_ASSERT(offsetof(struct payload, temperature) == 4, "Wrong position of temperature");
+BUILD_ASSERT(offsetof(struct payload, humidity) == 7, "Wrong position of humidity");
+BUILD_ASSERT(offsetof(struct payload, luminosite) == 10, "Wrong position of luminosite");
+BUILD_ASSERT(offsetof(struct payload, gnd_temperature) == 13, "Wrong position of gnd_temperature");
+BUILD_ASSERT(offsetof(struct payload, gnd_humidity) == 16, "Wrong position of gnd_humidity");
+BUILD_ASSERT(offsetof(struct payload, batterie) == 19, "Wrong position of batterie");
+BUILD_ASSERT(offsetof(struct payload, sample_age) == 22, "Wrong position of sample_age");
+
+/**
+ * @brief Encode a value into a pair
+ * 
+ * Rounded to 1 / scale then split, like encode_payload of the gateway (2.999 is 3.00).
+ * 
+ * @param pair pair of the payload
+ * @param id id of the value
+ * @param val value to encode
+ * @param scale the decimal part is in 1 / scale
+*/
+static inline void payload_encode_pair(struct payload_pair *pair, uint8_t id, float val, uint16_t scale) {
+    long n = lroundf(val * scale);
+    long whole = n / scale;
+    long decimal = n % scale;
+
+    if (decimal < 0) { /* Floor division, like divmod */
+        decimal += scale;
+        whole -= 1;
+    }
+    pair->id = id;
+    pair->whole = (uint8_t)whole;
+    pair->decimal = (uint8_t)decimal;
+}
+
+/**
+ * @brief Set the service UUID and the format version
+ * 
+ * @param payload payload to initialize
+*/
+static inline void payload_init(struct payload *payload) {
+    payload->uuid[0] = SERVICE_UUID_1;
+    payload->uuid[1] = SERVICE_UUID_2;
+    payload->version = PAYLOAD_FORMAT_VERSION;
+}
+
+/**
+ * @brief Encode the counter and the values of a reading
+ * 
+ * @param payload payload to encode into
+ * @param counter advertising counter
+ * @param data values of the reading
+*/
+static inline void payload_encode(struct payload *payload, uint8_t counter, const sensors_data_t *data) {
+    payload->counter = counter;
+    payload_encode_pair(&payload->temperature, TEMPERATURE_ID, data->temp, 100);
+    payload_encode_pair(&payload->humidity, HUMIDITY_ID, data->hum, 100);
+    payload_encode_pair(&payload->luminosite, LUMINOSITE_ID, data->lum, 100);
+    payload_encode_pair(&payload->gnd_temperature, GND_TEMPERATURE_ID, data->gnd_temp, 100);
+    payload_encode_pair(&payload->gnd_humidity, GND_HUMIDITY_ID, data->gnd_hum, 100);
+    payload_encode_pair(&payload->batterie, BATTERIE_ID, data->bat, 100);
+}
+
+/**
+ * @brief Encode the sample age
+ * 
+ * @param payload payload to encode into
+ * @param val seconds since the reading (capped at 255.99)
+*/
+static inline void payload_encode_sample_age(struct payload *payload, float val) {
+    if (val > SAMPLE_AGE_MAX) {
+        val = SAMPLE_AGE_MAX;
+    }
+    payload_encode_pair(&payload->sample_age, SAMPLE_AGE_ID, val, 100);
+}
+
+#endif /* PAYLOAD_H_ */